@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
+// DEFAULTS
+#define DEFAULT_YASH_PATH "./yash"
+#define DEFAULT_ITERATIONS 2000
+// an absolute path so the builtin true is skipped and every line really spawns
+#define BENCH_COMMAND "/bin/true\n"
+#define BENCH_PIPELINE "/bin/true | /bin/true | /bin/true\n"
+// a builtin never spawns, so this line measures parse_command + process_input + builtin dispatch
+#define BENCH_PARSE_LINE "true alpha 'beta gamma' \"delta epsilon\" zeta\\ eta theta iota kappa lambda mu\n"
+#define BENCH_PARSE_MULTIPLIER 50
+// the sleeps keep the background jobs alive, so the job table really holds all of them at once
+#define BENCH_BACKGROUND_LINE "/bin/sleep 1 &\n"
+#define BENCH_MAX_BACKGROUND_JOBS 512
+// a mix of builtins, single commands, pipelines, redirects and background jobs
+#define BENCH_MIXED_SCRIPT "echo hello > /dev/null\n/bin/echo a b c | /bin/cat\ncd /tmp\npwd\ntest -d /tmp\n/bin/true &\n"
+#define BENCH_MIXED_LINES 6
+// pipe throughput: the same file pushed through cat and through the <| splice feeder
+#define BENCH_PIPE_FILE "/tmp/yash_bench_pipe.dat"
+#define BENCH_PIPE_BYTES (64 << 20)
+#define BENCH_PIPE_ITERATIONS 8
+#define BENCH_PIPE_SIZE "1048576"
+// startup: a fresh yash per run with nothing to do, what automation starting lots of short lived shells pays each time
+#define BENCH_STARTUP_DIVISOR 4
+// coproc: the same one line request answered by a fresh process every time, and by one warm worker
+#define BENCH_COPROC_START "coproc worker /bin/cat\n"
+#define BENCH_COPROC_SEND "send worker request\n"
+#define BENCH_COPROC_SPAWN "/bin/echo request\n"
+// churn: short background jobs started faster than they finish, so add_job, reaping and remove_done_jobs overlap all the time
+// with a jobs every few lines walking the table in between, run it against make asan to catch memory errors under load
+#define BENCH_CHURN_LINE "/bin/true & /bin/true & /bin/true & /bin/true &\n"
+#define BENCH_CHURN_JOBS_PER_LINE 4
+#define BENCH_CHURN_BLOCK BENCH_CHURN_LINE BENCH_CHURN_LINE BENCH_CHURN_LINE BENCH_CHURN_LINE "jobs\n"
+#define BENCH_CHURN_LINES_PER_BLOCK 4
+
+// FUNCTION DEFINITIONS
+double now_seconds();
+char *repeat_line(const char *line, int count);
+double run_yash(const char *yash_path, const char *env_name, const char *env_value, const char *script);
+double run_repeated(const char *yash_path, const char *env_name, const char *env_value, const char *line, int iterations);
+void bench_parse(const char *yash_path, int iterations);
+void bench_spawn(const char *yash_path, int iterations);
+void bench_job_table(const char *yash_path, int iterations);
+void bench_end_to_end(const char *yash_path, int iterations);
+int create_pipe_file();
+void bench_pipe(const char *yash_path, int iterations);
+void bench_startup(const char *yash_path, int iterations);
+void bench_coproc(const char *yash_path, int iterations);
+void bench_churn(const char *yash_path, int iterations);
+
+// BENCHMARK TABLE - every benchmark prints one or more "bench=<name> key=value ..." lines
+typedef struct benchmark
+{
+    const char *name;
+    void (*run)(const char *yash_path, int iterations);
+} benchmark_t;
+
+benchmark_t benchmarks[] = {
+    {"parse", bench_parse},
+    {"spawn", bench_spawn},
+    {"job_table", bench_job_table},
+    {"end_to_end", bench_end_to_end},
+    {"pipe", bench_pipe},
+    {"startup", bench_startup},
+    {"coproc", bench_coproc},
+    {"churn", bench_churn},
+};
+#define BENCHMARK_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+int main(int argc, char **argv)
+{
+    // usage: bench [yash path] [iterations] [benchmark name]
+    const char *yash_path = (argc > 1) ? argv[1] : DEFAULT_YASH_PATH;
+    int iterations = (argc > 2) ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+    const char *only = (argc > 3) ? argv[3] : NULL;
+    if (iterations <= 0)
+    {
+        printf("Error [main]: iterations must be a positive number\n");
+        return 1;
+    }
+    int ran = 0;
+    for (size_t i = 0; i < BENCHMARK_COUNT; i++)
+    {
+        if (only == NULL || strcmp(only, benchmarks[i].name) == 0)
+        {
+            benchmarks[i].run(yash_path, iterations);
+            ran++;
+        }
+    }
+    if (ran == 0)
+    {
+        printf("Error [main]: unknown benchmark %s\n", only);
+        return 1;
+    }
+    return 0;
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+char *repeat_line(const char *line, int count)
+{
+    size_t length = strlen(line);
+    char *script = malloc(length * count + 1);
+    if (script == NULL)
+    {
+        perror("Error [repeat_line]");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        memcpy(script + i * length, line, length);
+    }
+    script[length * count] = '\0';
+    return script;
+}
+
+double run_yash(const char *yash_path, const char *env_name, const char *env_value, const char *script)
+{
+    // yash reads commands from the read end of this pipe, we feed it from the write end
+    int pipe_fd[2];
+    if (pipe(pipe_fd) < 0)
+    {
+        perror("Error [run_yash]");
+        return -1;
+    }
+    double start = now_seconds();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("Error [run_yash]");
+        return -1;
+    }
+    if (pid == 0)
+    {
+        int devnull = open("/dev/null", O_WRONLY);
+        close(pipe_fd[1]);
+        dup2(pipe_fd[0], STDIN_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        close(pipe_fd[0]);
+        close(devnull);
+        if (env_value != NULL)
+        {
+            setenv(env_name, env_value, 1);
+        }
+        execl(yash_path, yash_path, (char *)NULL);
+        _exit(EXIT_FAILURE);
+    }
+    close(pipe_fd[0]);
+    FILE *input = fdopen(pipe_fd[1], "w");
+    fputs(script, input);
+    // closing the pipe sends EOF, which makes yash exit
+    fclose(input);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        printf("Error [run_yash]: %s did not exit cleanly\n", yash_path);
+        return -1;
+    }
+    return now_seconds() - start;
+}
+
+double run_repeated(const char *yash_path, const char *env_name, const char *env_value, const char *line, int iterations)
+{
+    char *script = repeat_line(line, iterations);
+    double elapsed = run_yash(yash_path, env_name, env_value, script);
+    free(script);
+    return elapsed;
+}
+
+void bench_parse(const char *yash_path, int iterations)
+{
+    // parsing is far cheaper than spawning, so it gets more lines to stay measurable
+    int lines = iterations * BENCH_PARSE_MULTIPLIER;
+    double elapsed = run_repeated(yash_path, NULL, NULL, BENCH_PARSE_LINE, lines);
+    if (elapsed < 0)
+    {
+        return;
+    }
+    printf("bench=parse lines=%d seconds=%.3f lines_per_sec=%.1f\n", lines, elapsed, lines / elapsed);
+}
+
+void bench_spawn(const char *yash_path, int iterations)
+{
+    const char *spawn_modes[] = {"vfork", "fork"};
+    const char *shapes[] = {"single", "pipeline"};
+    const char *lines[] = {BENCH_COMMAND, BENCH_PIPELINE};
+    for (int i = 0; i < 2; i++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            double elapsed = run_repeated(yash_path, "YASH_SPAWN", spawn_modes[i], lines[j], iterations);
+            if (elapsed < 0)
+            {
+                continue;
+            }
+            printf("bench=spawn spawn_mode=%s shape=%s commands=%d seconds=%.3f commands_per_sec=%.1f usec_per_command=%.1f\n",
+                   spawn_modes[i], shapes[j], iterations, elapsed, iterations / elapsed, elapsed * 1e6 / iterations);
+        }
+    }
+}
+
+void bench_job_table(const char *yash_path, int iterations)
+{
+    // every background job goes through add_job while the table keeps growing, then the jobs at the end walks all of them
+    // yash exits without waiting, the orphaned sleeps finish on their own
+    // capped so the benchmark stays under the process limit
+    if (iterations > BENCH_MAX_BACKGROUND_JOBS)
+    {
+        iterations = BENCH_MAX_BACKGROUND_JOBS;
+    }
+    char *background = repeat_line(BENCH_BACKGROUND_LINE, iterations);
+    char *script = malloc(strlen(background) + sizeof("jobs\n"));
+    if (script == NULL)
+    {
+        perror("Error [bench_job_table]");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(script, background);
+    strcat(script, "jobs\n");
+    double elapsed = run_yash(yash_path, NULL, NULL, script);
+    free(background);
+    free(script);
+    if (elapsed < 0)
+    {
+        return;
+    }
+    printf("bench=job_table background_jobs=%d seconds=%.3f jobs_per_sec=%.1f\n", iterations, elapsed, iterations / elapsed);
+}
+
+void bench_end_to_end(const char *yash_path, int iterations)
+{
+    int repeats = iterations / BENCH_MIXED_LINES + 1;
+    int commands = repeats * BENCH_MIXED_LINES;
+    double elapsed = run_repeated(yash_path, NULL, NULL, BENCH_MIXED_SCRIPT, repeats);
+    if (elapsed < 0)
+    {
+        return;
+    }
+    printf("bench=end_to_end commands=%d seconds=%.3f commands_per_sec=%.1f\n", commands, elapsed, commands / elapsed);
+}
+
+int create_pipe_file()
+{
+    int fd = open(BENCH_PIPE_FILE, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+    {
+        perror("Error [create_pipe_file]");
+        return -1;
+    }
+    char block[65536];
+    memset(block, 'y', sizeof(block));
+    for (int written = 0; written < BENCH_PIPE_BYTES; written += sizeof(block))
+    {
+        if (write(fd, block, sizeof(block)) != sizeof(block))
+        {
+            perror("Error [create_pipe_file]");
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+void bench_pipe(const char *yash_path, int iterations)
+{
+    // the file size is fixed, so the iteration count doesn't apply here
+    (void)iterations;
+    const char *pipe_modes[] = {"cat", "splice"};
+    const char *lines[] = {"/bin/cat " BENCH_PIPE_FILE " | /usr/bin/wc -c\n", "/usr/bin/wc -c <| " BENCH_PIPE_FILE "\n"};
+    const char *pipe_sizes[] = {NULL, BENCH_PIPE_SIZE};
+    if (create_pipe_file() < 0)
+    {
+        return;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            double elapsed = run_repeated(yash_path, "YASH_PIPE_SIZE", pipe_sizes[j], lines[i], BENCH_PIPE_ITERATIONS);
+            if (elapsed < 0)
+            {
+                continue;
+            }
+            double megabytes = (double)BENCH_PIPE_BYTES * BENCH_PIPE_ITERATIONS / (1 << 20);
+            printf("bench=pipe pipe_mode=%s pipe_size=%s megabytes=%.0f seconds=%.3f megabytes_per_sec=%.1f\n", pipe_modes[i],
+                   (pipe_sizes[j] != NULL) ? pipe_sizes[j] : "default", megabytes, elapsed, megabytes / elapsed);
+        }
+    }
+    unlink(BENCH_PIPE_FILE);
+}
+
+void bench_startup(const char *yash_path, int iterations)
+{
+    int starts = iterations / BENCH_STARTUP_DIVISOR + 1;
+    double start = now_seconds();
+    for (int i = 0; i < starts; i++)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            perror("Error [bench_startup]");
+            return;
+        }
+        if (pid == 0)
+        {
+            execl(yash_path, yash_path, "-c", "", (char *)NULL);
+            _exit(EXIT_FAILURE);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            printf("Error [bench_startup]: %s did not exit cleanly\n", yash_path);
+            return;
+        }
+    }
+    double elapsed = now_seconds() - start;
+    printf("bench=startup starts=%d seconds=%.3f usec_per_start=%.1f\n", starts, elapsed, elapsed * 1e6 / starts);
+}
+
+void bench_coproc(const char *yash_path, int iterations)
+{
+    const char *modes[] = {"spawn", "coproc"};
+    char *sends = repeat_line(BENCH_COPROC_SEND, iterations);
+    char *scripts[2];
+    scripts[0] = repeat_line(BENCH_COPROC_SPAWN, iterations);
+    scripts[1] = malloc(strlen(BENCH_COPROC_START) + strlen(sends) + 1);
+    if (scripts[1] == NULL)
+    {
+        perror("Error [bench_coproc]");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(scripts[1], BENCH_COPROC_START);
+    strcat(scripts[1], sends);
+    free(sends);
+    for (int i = 0; i < 2; i++)
+    {
+        double elapsed = run_yash(yash_path, NULL, NULL, scripts[i]);
+        free(scripts[i]);
+        if (elapsed < 0)
+        {
+            continue;
+        }
+        printf("bench=coproc mode=%s requests=%d seconds=%.3f requests_per_sec=%.1f usec_per_request=%.1f\n", modes[i], iterations,
+               elapsed, iterations / elapsed, elapsed * 1e6 / iterations);
+    }
+}
+
+void bench_churn(const char *yash_path, int iterations)
+{
+    // iterations is the number of background jobs, a sanitizer build exits non zero on the first error and fails the run
+    int blocks = iterations / (BENCH_CHURN_LINES_PER_BLOCK * BENCH_CHURN_JOBS_PER_LINE) + 1;
+    int jobs = blocks * BENCH_CHURN_LINES_PER_BLOCK * BENCH_CHURN_JOBS_PER_LINE;
+    double elapsed = run_repeated(yash_path, NULL, NULL, BENCH_CHURN_BLOCK, blocks);
+    if (elapsed < 0)
+    {
+        return;
+    }
+    printf("bench=churn background_jobs=%d seconds=%.3f jobs_per_sec=%.1f\n", jobs, elapsed, jobs / elapsed);
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <dirent.h>
@@ -5,9 +6,24 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include <pwd.h>
+#include <fnmatch.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
 #include <errno.h>
+#include <time.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 
@@ -17,14 +33,58 @@
 // IDENTIFIERS
 #define INPUT_REDIRECT "<"
 #define OUTPUT_REDIRECT ">"
-#define ERROR_REDIRECT "2>"
+#define APPEND_REDIRECT ">>"
+#define DUPLICATE_INPUT "<&"
+#define DUPLICATE_OUTPUT ">&"
+#define BOTH_REDIRECT "&>"
+#define BOTH_APPEND_REDIRECT "&>>"
+#define CLOSE_FD "-"
 #define PIPE "|"
+#define SPLICE_REDIRECT "<|"
 #define SEND_TO_BACKGROUND "&"
+#define HERE_DOCUMENT "<<"
+#define HERE_STRING "<<<"
+#define INPUT_SUBSTITUTION "<("
+#define OUTPUT_SUBSTITUTION ">("
+#define SEQUENCE ";"
+#define AND_LIST "&&"
+#define OR_LIST "||"
 
 // JOB CONTROL COMMANDS
 #define FOREGROUND "fg"
 #define BACKGROUND "bg"
 #define JOBS "jobs"
+#define HASH "hash"
+#define PARALLEL "parallel"
+#define WAIT "wait"
+#define HISTORY "history"
+#define OUTPUT "output"
+#define ULIMIT "ulimit"
+#define ULIMIT_ALL_FLAG "-a"
+#define ULIMIT_SOFT_FLAG "-S"
+#define ULIMIT_HARD_FLAG "-H"
+#define ULIMIT_UNLIMITED "unlimited"
+#define COPROC "coproc"
+#define COPROC_WORKERS_FLAG "-n"
+#define COPROC_CLOSE_FLAG "-c"
+#define SEND "send"
+#define SEND_BACKGROUND_FLAG "-b"
+#define HISTORY_SEARCH_FLAG "-s"
+#define JOB_SPEC_PREFIX '%'
+#define PARALLEL_JOBS_FLAG "-j"
+#define PARALLEL_SEPARATOR ":::"
+#define PARALLEL_PLACEHOLDER "{}"
+// characters the lexer would treat specially in a rebuilt command line
+#define PARALLEL_QUOTED_CHARS " \t'\"\\|<>&#;"
+#define SAVED_FD_MIN 10
+// like in sh, only the fds 0-9 can be redirected, the shell keeps its own copies above them
+#define REDIRECT_FD_LIMIT 10
+#define TIME_KEYWORD "time"
+#define CACHE_KEYWORD "cache"
+#define CACHE_TTL_FLAG "-t"
+#define CACHE_WATCH_FLAG "-w"
+#define VERBOSE_FLAG "-v"
+#define SESSION_SUMMARY_ENV "YASH_SESSION_SUMMARY"
 #define FG_JOB_NUM -1
 
 // CUSTOM ERRORS IDS
@@ -33,11 +93,159 @@
 #define COMMAND_PROCESSING_ERROR -1
 #define FILE_REDIRECTION_ERROR -1
 
+// SPAWN MODES
+#define SPAWN_MODE_VFORK 0
+#define SPAWN_MODE_FORK 1
+#define SPAWN_MODE_ENV "YASH_SPAWN"
+
+// PIPES
+#define PIPE_SIZE_ENV "YASH_PIPE_SIZE"
+#define SPLICE_CHUNK_SIZE (1 << 20)
+
+// BACKGROUND OUTPUT CAPTURE
+// YASH_BG_OUTPUT=capture sends the stdout/stderr of background jobs into a ring buffer per job instead of the terminal
+#define OUTPUT_CAPTURE_ENV "YASH_BG_OUTPUT"
+#define OUTPUT_CAPTURE_MODE "capture"
+#define OUTPUT_RING_SIZE 65536
+#define OUTPUT_RING_TABLE_INITIAL_CAPACITY 16
+
+// JOB CGROUPS
+// YASH_CGROUP=<cgroup v2 directory the shell may write to> gives every job its own leaf cgroup below it
+#define CGROUP_ENV "YASH_CGROUP"
+// limits written into each leaf, in the kernel's own formats (e.g. 512M, "50000 100000", 64)
+#define CGROUP_MEMORY_MAX_ENV "YASH_JOB_MEMORY_MAX"
+#define CGROUP_CPU_MAX_ENV "YASH_JOB_CPU_MAX"
+#define CGROUP_PIDS_MAX_ENV "YASH_JOB_PIDS_MAX"
+#define CGROUP_STAT_BUFFER_SIZE 1024
+
+// RESULT CACHE
+// cache [-t seconds] [-w file]... pipeline replays the stdout of the last successful run while it is still valid
+#define RESULT_CACHE_DEFAULT_TTL 10.0
+#define RESULT_CACHE_MAX_BYTES (4 << 20)
+// colon separated names of extra environment variables a cached result depends on, PATH and the cwd always count
+#define RESULT_CACHE_ENV "YASH_CACHE_ENV"
+#define RESULT_CACHE_READ_CHUNK 65536
+
+// HERE DOCUMENTS AND PROCESS SUBSTITUTION
+#define HERE_DOCUMENT_PROMPT "> "
+// a substitution runs its command through another copy of this shell
+#define SELF_EXE_PATH "/proc/self/exe"
+#define SUBSTITUTION_PATH_SIZE 32
+
+// ARENA SIZING
+#define ARENA_BLOCK_SIZE 4096
+#define ARENA_ALIGNMENT 16
+
+// SCRIPT INPUT
+#define SCRIPT_READ_CHUNK 65536
+#define COMMAND_STRING_FLAG "-c"
+// reports how long each startup phase took on stderr, always the first argument
+#define STARTUP_STATS_FLAG "--startup-stats"
+#define SERVER_FLAG "--listen"
+#define COMMENT_CHAR '#'
+
+// COMMAND PATH CACHE
+#define COMMAND_CACHE_INITIAL_BUCKETS 64
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+// JOB TABLE SIZING
+#define JOB_TABLE_INITIAL_CAPACITY 16
+#define PID_TABLE_INITIAL_BUCKETS 64
+#define PID_TABLE_MAX_LOAD 2
+// statuses a script's freed background jobs keep for wait, the oldest one makes room once it is full
+#define SAVED_STATUS_MAX 1024
+
+// HISTORY
+#define HISTORY_FILE_ENV "YASH_HISTFILE"
+#define HISTORY_FILE_NAME ".yash_history"
+// only this many of the newest entries are loaded into readline for up-arrow, the rest is reached through the index
+#define HISTORY_LOAD_LIMIT 1000
+#define HISTORY_INDEX_INITIAL_CAPACITY 1024
+// M-p: prefix search through the whole history file
+#define HISTORY_SEARCH_KEYSEQ "\033p"
+
+// EXPANSION
+// what the lexer saw in a word, only words with one of these go through expand_words
+#define EXPAND_VARIABLES 1
+#define EXPAND_TILDE 2
+#define EXPAND_GLOB 4
+// how every character of a lexed word was quoted, the quotes themselves are gone by then
+#define CHAR_UNQUOTED 0
+#define CHAR_DOUBLE_QUOTED 1 // only $ is still special
+#define CHAR_LITERAL 2       // single quoted or backslash escaped
+#define GLOB_CHARS "*?["
+// unquoted expansions are split into words at these, like the default IFS
+#define FIELD_SEPARATORS " \t\n"
+#define VARIABLE_NAME_MAX 256
+#define WORD_BUFFER_INITIAL_CAPACITY 256
+#define TRUE_COMMAND "true" // the builtin standing in for a command that expanded to nothing
+
+// COMPLETION
+#define DIRECTORY_CACHE_MAX 64
+#define COMPLETION_MATCHES_INITIAL_CAPACITY 64
+
+// PARALLEL QUEUE SIZING
+#define PARALLEL_QUEUE_INITIAL_CAPACITY 64
+
+// EVENT LOOP
+// every epoll registration carries what it is in the upper half of its data and a job number or pid in the lower half
+#define EVENT_TAG(source, value) (((uint64_t)(source) << 32) | (uint32_t)(value))
+#define EVENT_SOURCE(data) ((int)((data) >> 32))
+#define EVENT_VALUE(data) ((int)(uint32_t)(data))
+#define EVENT_BATCH_SIZE 64
+
+// COPROCESSES
+#define COPROC_MAX_WORKERS 64
+#define COPROC_READ_CHUNK 4096
+
+// SERVER MODE
+// yash --listen <socket path>: every line a client writes is a command line, run as a background job
+// replies are key=value lines tagged with the request's number on its connection, they come whenever the job changes state
+#define SERVER_BACKLOG 64
+#define SERVER_READ_CHUNK 4096
+#define SERVER_MAX_LINE 65536
+#define SERVER_REPLY_SIZE 512
+
+// FUZZ DRIVER AND STRESS TEST
+// make fuzz_driver replays inputs through the fuzz entry point, make stress churns the job table, both under the sanitizers
+#define FUZZ_READ_CHUNK 4096
+#define STRESS_DEFAULT_ROUNDS 5000
+#define STRESS_JOBS_PER_ROUND 8
+#define STRESS_COMMAND "sleep 1 | grep x > /dev/null &"
+// made up pids, nothing is spawned
+#define STRESS_FIRST_PID 100000
+
+// TRACING
+// compiled in with -DYASH_TRACE (make trace), then YASH_TRACE=<directory> has every shell process write
+// a Chrome trace (chrome://tracing, ui.perfetto.dev) named yash-trace-<pid>.json there
+#ifdef YASH_TRACE
+#define TRACE_ENV "YASH_TRACE"
+#define TRACE_BUFFER_EVENTS 8192
+#define TRACE_BEGIN(name) trace_event(name, 'B', -1, 0)
+#define TRACE_END(name, pid) trace_event(name, 'E', pid, 0)
+#define TRACE_INSTANT(name, pid, value) trace_event(name, 'i', pid, value)
+#else
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_END(name, pid) ((void)0)
+#define TRACE_INSTANT(name, pid, value) ((void)0)
+#endif
+
 // MISC
 #define TERMINAL_PROMPT "# "
-#define COMMAND_DELIMETER " \t"
 
 // ENUMS
+enum event_source
+{
+    EVENT_TERMINAL,
+    EVENT_CHILD_SIGNAL, // the SIGCHLD signalfd, still needed for stops and for children without a pidfd
+    EVENT_PROCESS,      // a pidfd, readable once that process exited
+    EVENT_OUTPUT_RING,  // a background job's capture pipe
+    EVENT_CACHE,        // the output of the cached foreground job
+    EVENT_COPROC,       // a coprocess worker's answers
+    EVENT_SERVER,       // the listening socket of server mode
+    EVENT_SERVER_CLIENT // a connection to it, by fd
+};
+
 enum job_status
 {
     RUNNING,
@@ -45,64 +253,656 @@ enum job_status
     DONE
 };
 
+enum token_type
+{
+    TOKEN_WORD,
+    TOKEN_REDIRECT,
+    TOKEN_PIPE,
+    TOKEN_SPLICE_REDIRECT,
+    TOKEN_BACKGROUND,
+    TOKEN_SEQUENCE,
+    TOKEN_AND,
+    TOKEN_OR,
+    TOKEN_HERE_DOCUMENT,
+    TOKEN_HERE_STRING,
+    TOKEN_INPUT_SUBSTITUTION,
+    TOKEN_OUTPUT_SUBSTITUTION
+};
+
+enum redirect_type
+{
+    REDIRECT_READ,
+    REDIRECT_WRITE,
+    REDIRECT_APPEND,
+    REDIRECT_DUPLICATE,
+    REDIRECT_HERE_DOCUMENT
+};
+
 // STRUCTS
+typedef struct token
+{
+    // a slice of the command buffer, word tokens are NUL terminated in place
+    enum token_type type;
+    int offset;
+    int length;
+    int quoted;
+    int expand; // EXPAND_* of everything unquoted in the word
+    // TOKEN_REDIRECT only
+    enum redirect_type redirect_type;
+    int redirect_fd;
+    int redirect_both;  // &> and &>>, stdout and stderr to the same file
+    const char *symbol; // for error messages, the lexed text may already be overwritten
+} token_t;
+
+typedef struct word_buffer
+{
+    // a growing string, and for every character whether it is still a glob pattern character
+    char *text;
+    char *pattern;
+    size_t length;
+    size_t capacity;
+} word_buffer_t;
+
+typedef struct redirect
+{
+    // one redirect of a pipeline stage, they are applied in command line order like in sh
+    enum redirect_type type;
+    int fd;          // the fd that gets replaced
+    int source_fd;   // REDIRECT_DUPLICATE: the fd copied onto fd, -1 closes fd
+    char *filename;  // REDIRECT_READ, REDIRECT_WRITE and REDIRECT_APPEND
+    char *text;      // REDIRECT_HERE_DOCUMENT, fed through a memfd
+    size_t text_length;
+    char *delimiter; // <<, the text itself is read from the lines after the command
+    int from_lines;  // a << whose text was read (or is still to be read) from the lines after the command, not a <<<
+    struct redirect *next;
+} redirect_t;
+
+typedef struct arena_block
+{
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    char data[];
+} arena_block_t;
+
+typedef struct arena
+{
+    // blocks are bump allocated from the head, older (full) blocks follow
+    arena_block_t *head;
+} arena_t;
+
 typedef struct process
 {
-    char *argv[MAX_ARGS + 1];
-    char *redirect_input_filename;
-    char *redirect_output_filename;
-    char *redirect_error_filename;
+    char **argv; // NULL terminated, allocated from the job's arena
+    const char *exec_path; // argv[0] resolved through the command cache right before spawning
+    int exec_errno;        // written by a vfork child (shared memory) when its execve fails
+    redirect_t *redirects; // in command line order
+    char *splice_input_filename; // set on the feeder stage of <|, which runs inside the shell's child instead of exec'ing
+    struct builtin *builtin;     // a builtin stage of a pipeline or background job, it runs inside the shell's child instead of exec'ing
+    struct process *substitutions; // the <(cmd) and >(cmd) of this stage, linked through next
+    enum token_type substitution_type; // on a substitution: which way its pipe goes
+    int substitution_fd;               // the stage's end of the pipe, passed to it as /dev/fd/N
+    int helper_fd;                     // the substitution command's end of the pipe
+    char *substitution_path;           // /dev/fd/N, the stage's argv (or redirect) points at this buffer
+    pid_t pid;
+    int pidfd; // refers to exactly this process until it is reaped, -1 when pidfds are unavailable
+    int cloned_into_cgroup; // born in the job's cgroup by clone3, otherwise the child writes itself into cgroup.procs
+    int completed;
+    int stopped;
+    int status;
+    int exit_code;         // exit status, or 128 + signal number when killed
+    struct rusage usage;   // filled in by wait4 when the process is reaped
+    struct timespec end_time;
+    struct process *next;
+    struct process_group *job; // owning job, set while the process is in the pid table
+    struct process *pid_next;  // chaining in the pid table bucket
 } process_t;
 
+typedef struct cache_request
+{
+    // set up by the cache keyword, lives in the job's arena except for the captured output
+    double ttl;
+    char **watch_paths; // point into the command line
+    struct timespec *watch_mtimes; // taken right before the run, so changes during it invalidate the result
+    int watch_count;
+    char *key; // malloc'd, handed over to the cache entry
+    size_t key_length;
+    unsigned int hash;
+    int read_fd;  // the shell's end of the last stage's stdout
+    int write_fd; // the last stage's end while spawning
+    char *output; // malloc'd copy of everything passed through so far
+    size_t output_length;
+    size_t output_capacity;
+    int overflow; // too big for the cache, still passed through
+} cache_request_t;
+
+typedef struct coproc_worker
+{
+    process_t *process; // one stage of the pool's job
+    int fd;             // the shell's end of the socketpair that is the worker's stdin and stdout, -1 once the worker closed it
+    int busy;           // a request went out and its answer hasn't been printed yet
+    int answered;       // the answer (a full line) is in the buffer
+    char *response;     // malloc'd, what the worker wrote back since the last answer was printed
+    size_t response_length;
+    size_t response_capacity;
+} coproc_worker_t;
+
+typedef struct coproc_pool
+{
+    // lives in the arena of its job, and goes away with it once every worker exited
+    char *name;
+    struct process_group *job;
+    coproc_worker_t *workers;
+    int worker_count;
+    struct coproc_pool *next;
+} coproc_pool_t;
+
+typedef struct server_client
+{
+    int fd;
+    int requests;     // lines read so far, the number of the next request is one more
+    int jobs_running; // started and not done yet, the connection stays open for their replies after the client stopped writing
+    int eof;          // the client shut down its end, nothing more is read
+    int broken;       // a write failed, the connection is closed once the event loop is done with it
+    uint32_t events;  // what the fd is registered for in the epoll set, 0 when it isn't
+    char *input;      // malloc'd, a partial request line
+    size_t input_length;
+    size_t input_capacity;
+    char *output; // malloc'd, replies the socket couldn't take yet
+    size_t output_length;
+    size_t output_capacity;
+    struct server_client *next;
+} server_client_t;
+
 typedef struct process_group
 {
+    arena_t *arena; // owns the job itself, its command strings and all of its processes
     pid_t pgid;
     char *command;
     int job_number;
     int background;
     enum job_status status;
-    process_t *first_process;
-    process_t *second_process;
-    struct process_group *next;
+    int exit_code;  // exit code of the last pipeline stage, once the job is DONE
+    int timed;      // started with the time keyword
+    int parallel;   // started by the parallel builtin, frees a slot for the next queued command when done
+    int capture_fd; // write end of the output capture pipe while the job is being spawned, -1 otherwise
+    cache_request_t *cache; // started with the cache keyword and not served from the cache
+    coproc_pool_t *coproc;  // the workers of a coproc pool, every worker is one process of the job
+    server_client_t *server_client; // the connection that asked for the job in server mode, NULL once it is gone
+    int server_request;             // the number of that request on its connection
+    char *cgroup_path;      // the job's leaf cgroup while it exists (YASH_CGROUP mode only)
+    int cgroup_fd;          // the leaf's directory, handed to clone3, -1 once the job is done
+    int cgroup_procs_fd;    // its cgroup.procs, for children that could not be cloned straight into it
+    struct cgroup_usage
+    {
+        long user_usec;
+        long system_usec;
+        long memory_peak; // bytes, -1 without the memory controller
+    } cgroup_usage; // the last figures read from the leaf
+    struct timespec start_time;
+    struct timespec end_time;
+    process_t *first_process; // pipeline stages, linked through process->next
+    struct process_group *done_next; // link in the job table's done list
+    int waited;                      // its status was taken by wait, so it is not saved when it is freed
+    enum token_type list_operator;   // ;, && or || in front of this job on its command line (; for the first one)
+    struct process_group *list_next; // the next job of the same command line, until the line has been run
+    // a job with $, ~ or glob words keeps what it was lexed from, expand_job rebuilds it from that right before it runs
+    token_t *lexed_tokens;
+    int lexed_token_count;
+    char *lexed_buffer;
+    char *lexed_quoting;
 } job_t;
 
+typedef struct script_reader
+{
+    // lines are handed out as (pointer, length) slices of this buffer
+    char *buffer;
+    size_t length;
+    size_t position;
+    size_t capacity;
+    int fd;
+    int mapped; // the whole script is mmap'd (or is a -c string), so there is nothing left to read
+    int eof;
+} script_reader_t;
+
+typedef struct command_cache_entry
+{
+    char *name;
+    char *path;
+    int hits;
+    struct command_cache_entry *next;
+} command_cache_entry_t;
+
+typedef struct command_cache
+{
+    // command name -> absolute path, like bash's hash table
+    command_cache_entry_t **buckets;
+    int bucket_count;
+    int count;
+    // the PATH the entries were resolved against, everything is dropped once it changes
+    char *path_env;
+} command_cache_t;
+
+typedef struct builtin
+{
+    const char *name;
+    int (*handler)(char *argv[]); // returns the exit status of the builtin
+} builtin_t;
+
+typedef struct history_file
+{
+    // append-only file with one command per line, shared by every session and mmap'd instead of parsed at startup
+    int fd;
+    char *map;
+    size_t map_length;
+    // offsets of the entries in map sorted by their text (equal entries in file order), built on the first search
+    size_t *index;
+    size_t index_count;
+    size_t index_capacity;
+    size_t indexed_length; // the index covers every complete line in map[0, indexed_length)
+    // state of consecutive M-p presses
+    char *search_prefix;
+    long search_match;
+} history_file_t;
+
+typedef struct directory_entry
+{
+    char *name;             // points into the listing's name buffer
+    unsigned char is_dir;
+    signed char executable; // -1 until a command completion first needs it
+} directory_entry_t;
+
+typedef struct directory_listing
+{
+    // one readdir of a directory sorted by name, reused for completion until the directory's mtime changes
+    char *path;
+    struct timespec mtime;
+    directory_entry_t *entries;
+    int count;
+    char *names;
+    struct directory_listing *next; // most recently used first
+} directory_listing_t;
+
+typedef struct output_ring
+{
+    // the last OUTPUT_RING_SIZE bytes a captured background job wrote, kept after the job is gone until its number is reused
+    int job_number;
+    int fd; // non blocking read end of the capture pipe, -1 once every writer closed it
+    char *command;
+    char data[OUTPUT_RING_SIZE];
+    size_t start;
+    size_t length;
+    size_t dropped; // bytes overwritten because nobody looked at them in time
+} output_ring_t;
+
+typedef struct result_cache_entry
+{
+    char *key; // every word, redirect, the cwd and the selected env of the job, NUL separated
+    size_t key_length;
+    unsigned int hash;
+    char *command;
+    char *output;
+    size_t output_length;
+    struct timespec expires;
+    char **watch_paths;
+    struct timespec *watch_mtimes;
+    int watch_count;
+    int hits;
+    struct result_cache_entry *prev; // LRU order, most recently used at the head
+    struct result_cache_entry *next;
+} result_cache_entry_t;
+
+typedef struct result_cache
+{
+    result_cache_entry_t *head;
+    result_cache_entry_t *tail;
+    size_t bytes; // output held by all entries, kept under RESULT_CACHE_MAX_BYTES
+    int count;
+} result_cache_t;
+
+#ifdef YASH_TRACE
+typedef struct trace_event
+{
+    const char *name; // always a string literal
+    char phase;       // B(egin), E(nd) or i(nstant), as in the Chrome trace format
+    pid_t pid;        // the child the event is about, -1 for none
+    int value;
+    struct timespec time;
+} trace_event_t;
+#endif
+
+typedef struct ulimit_resource
+{
+    char flag;
+    int resource;
+    int unit; // bytes per unit, like bash's ulimit
+    const char *description;
+} ulimit_resource_t;
+
+typedef struct parallel_queue
+{
+    // command lines of the parallel builtin waiting for a free slot, malloc'd since they outlive the builtin's job
+    char **commands;
+    int count;
+    int next; // commands before this one have been started
+    int capacity;
+    int max_running;
+    int running;
+} parallel_queue_t;
+
+typedef struct saved_status
+{
+    pid_t pid; // 0 for a free slot
+    pid_t pgid;
+    int job_number;
+    int exit_code;
+} saved_status_t;
+
+typedef struct job_table
+{
+    // background jobs indexed by their job number (slot 0 is never used)
+    job_t **jobs;
+    int capacity;
+    int highest_job_num;
+    // the job registered with FG_JOB_NUM, if any
+    job_t *fg_job;
+    // cache for find_next_job_to_bg, re-validated on every lookup
+    job_t *most_recent_stopped_job;
+    int most_recent_stopped_job_valid;
+    // jobs that finished since the last notification, in job number order, so notifying and cleaning up never walks the table
+    job_t *done_jobs;
+    // every pipeline stage of every job keyed by pid, so reaped pids and pgids map straight to jobs
+    process_t **pid_buckets;
+    int pid_bucket_count;
+    int pid_count;
+    // exit statuses of a script's background jobs that were freed before wait asked for them, one per pid, as a ring
+    saved_status_t saved_statuses[SAVED_STATUS_MAX];
+    int saved_status_next;
+    int saved_status_count;
+} job_table_t;
+
 // FUNCTION DEFINITIONS
-int parse_command(char *command, char *buffer[]);
-int process_input(int tokenized_command_length, char *tokenized_command[], job_t *job);
+int parse_command(char *command, char *quoting, token_t tokens[], int max_tokens);
+enum token_type classify_operator(char c, char next, int *length);
+int lex_redirect(const char *read, char c, token_t *token);
+const char *token_type_str(enum token_type type);
+int process_input(int token_count, token_t tokens[], char *buffer, job_t *job);
+job_t *parse_job_line(char *command, size_t len);
+job_t *parse_list_part(job_t *job, char *command, size_t len, char *command_copy, char *quoting, token_t tokens[], int start, int end, int token_count);
+void free_job_list(job_t *job);
+
+// EXPANSION FUNCTIONS
+void keep_lexed_words(job_t *job, char *buffer, char *quoting, token_t tokens[], int token_count);
+job_t *expand_job(job_t *job);
+void expand_words(job_t *job, char **buffer, const char *quoting, token_t **tokens, int *token_count);
+int expand_word(const char *word, const char *quoting, size_t length, int flags, int split, word_buffer_t *output);
+const char *lookup_variable(const char *text, const char *quoting, char quote, size_t length, size_t *consumed, char number[]);
+const char *tilde_directory(const char *user, size_t length);
+int end_expanded_word(word_buffer_t *field, word_buffer_t *output);
+int expand_glob(word_buffer_t *field, size_t position, word_buffer_t *path, int check, word_buffer_t *output);
+void append_word_text(word_buffer_t *buffer, const char *text, size_t length, int pattern);
 void execute_job(job_t *job);
+void execute_job_list(job_t *job);
 int execute_process(job_t *job);
 int execute_pipe_process(job_t *job);
+pid_t spawn_process(job_t *job, process_t *process, pid_t pgid, int input_fd, int output_fd);
+void exec_child(job_t *job, process_t *process, pid_t pgid, int input_fd, int output_fd) __attribute__((noreturn));
+int splice_file_to_stdout(const char *filename);
+void set_pipe_size(int fd);
 void continue_background_job(job_t *job, int fg);
 void execute_in_foreground(job_t *job);
 void nuke_all_file_descriptors();
-int execute_custom_commands();
+int execute_custom_commands(job_t *job);
 
 // JOB CONTROL DATA STRUCTURE
-job_t *job_list_head;
+job_table_t job_table;
 
 // JOB CONTROL FUNCTIONS
 void update_job_command_str(job_t *job, int fg);
-void print_job_table(int print_running_jobs, int print_stopped_jobs, int print_done_jobs);
-void print_job(job_t *job, int is_most_recent_job, int custom_command, int command_is_fg);
+void print_job_table(int print_running_jobs, int print_stopped_jobs, int print_done_jobs, int verbose);
+void print_job(job_t *job, int is_most_recent_job, int custom_command, int command_is_fg, int verbose);
+void print_job_usage(job_t *job);
+void print_job_times(job_t *job);
+void job_total_usage(job_t *job, struct rusage *usage);
+double elapsed_seconds(struct timespec *start, struct timespec *end);
+double timeval_seconds(struct timeval *tv);
 job_t *find_job(pid_t pgid);
+job_t *find_process_job(pid_t pid, process_t **process);
+int job_is_completed(job_t *job);
+int job_is_stopped(job_t *job);
 job_t *find_next_job_to_bg();
 job_t *find_next_job_to_fg();
 int find_most_recent_job_num();
 int remove_job(pid_t pgid, int fg_free);
 void remove_done_jobs();
+void save_job_status(job_t *job);
+int find_saved_status(const char *spec);
+void forget_saved_status(int slot);
 void add_job(job_t *job);
+void detach_job(job_t *job);
+void note_stopped_job(job_t *job);
+void note_done_job(job_t *job);
+void print_done_jobs();
+void init_job_table();
 void free_job_table();
+void pid_table_insert(process_t *process);
+void pid_table_remove(process_t *process);
+process_t *pid_table_lookup(pid_t pid);
+void pid_table_grow();
 void free_job(job_t *job);
-void free_process(process_t *process);
+job_t *create_job(char *command, size_t len);
+process_t *create_process(job_t *job, int argc);
+int count_stage_words(int start, int token_count, token_t tokens[]);
+char *add_process_substitution(job_t *job, process_t *process, token_t *token, char *buffer);
+redirect_t *add_redirect(job_t *job, process_t *process, enum redirect_type type, int fd);
+int add_redirect_token(job_t *job, process_t *process, token_t *token, char *target);
+int redirects_fd(process_t *process, int fd);
 int apply_file_redirects(process_t *process);
-void update_job_table_statuses();
-int update_job_status(int status, pid_t pid);
+int open_here_document(const char *text, size_t length);
+void open_process_substitutions(job_t *job);
+void start_process_substitutions(job_t *job, pid_t pgid);
+void print_file_redirection_error_str(char *filename);
+void write_error_message(const char *subject, int error);
+int update_job_table_statuses();
+int update_job_status(int status, pid_t pid, struct rusage *usage);
+
+// SCRIPT INPUT FUNCTIONS
+int parse_arguments(int argc, char *argv[]);
+int open_script_reader(script_reader_t *reader, int fd);
+void open_string_reader(script_reader_t *reader, char *str);
+char *read_script_line(script_reader_t *reader, size_t *len);
+void report_done_jobs();
+void read_here_documents(job_t *job);
+void read_here_document(redirect_t *redirect, job_t *job);
+int signal_job(job_t *job, int sig);
+
+// EVENT LOOP FUNCTIONS
+int init_child_notifications();
+int drain_child_notifications();
+int add_event_source(int fd, enum event_source source, int value);
+void remove_event_source(int fd);
+int wait_for_events(job_t *job, int *terminal_ready);
+int wait_for_child_events();
+void track_process(process_t *process, int pidfd);
+void reap_process(pid_t pid);
+void release_process_pidfd(process_t *process);
+void init_line_editor();
+char *read_command(const char *prompt);
+void handle_command_line(char *line);
+void notify_done_jobs();
+
+// SERVER FUNCTIONS
+void run_server(const char *path) __attribute__((noreturn));
+void accept_server_clients();
+server_client_t *find_server_client(int fd);
+void read_server_client(server_client_t *client);
+void run_server_request(server_client_t *client, char *line, size_t length);
+void send_server_reply(server_client_t *client, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void send_job_reply(job_t *job, const char *event);
+void finish_server_job(job_t *job);
+void flush_server_client(server_client_t *client);
+void update_server_client_events(server_client_t *client);
+void close_finished_server_clients();
+void close_server_client(server_client_t *client);
 
 // CUSTOM COMMAND FUNCTIONS
-int execute_custom_commands();
-void execute_bg();
-void execute_fg();
-void execute_jobs();
+int execute_custom_commands(job_t *job);
+builtin_t *find_builtin(const char *name);
+int run_builtin(builtin_t *builtin, process_t *process);
+int save_fd(int fd);
+void restore_fd(int saved_fd, int fd);
+int execute_bg(char *argv[]);
+int execute_fg(char *argv[]);
+int execute_jobs(char *argv[]);
+int execute_hash(char *argv[]);
+int execute_parallel(char *argv[]);
+int execute_wait(char *argv[]);
+int execute_history(char *argv[]);
+int execute_output(char *argv[]);
+int execute_cache(char *argv[]);
+int execute_ulimit(char *argv[]);
+int execute_coproc(char *argv[]);
+int execute_send(char *argv[]);
+void print_ulimit(ulimit_resource_t *resource, int hard, int with_description);
+job_t *find_job_spec(const char *spec);
+int waiting_on_jobs(job_t *targets[], int target_count);
+void handle_wait_interrupt(int sig);
+int execute_cd(char *argv[]);
+int execute_pwd(char *argv[]);
+int execute_echo(char *argv[]);
+int execute_true(char *argv[]);
+int execute_false(char *argv[]);
+int execute_export(char *argv[]);
+int execute_unset(char *argv[]);
+int execute_exit(char *argv[]);
+int execute_test(char *argv[]);
+int evaluate_test(int argc, char *argv[]);
+
+// COMMAND PATH CACHE FUNCTIONS
+const char *resolve_command(const char *name);
+char *search_path(const char *name, const char *path_env);
+command_cache_entry_t *command_cache_lookup(const char *name);
+void command_cache_insert(const char *name, char *path);
+void command_cache_forget(const char *name);
+void command_cache_clear();
+void command_cache_check_path();
+void command_cache_grow();
+unsigned int hash_string(const char *str);
+unsigned int hash_bytes(const char *data, size_t length);
+
+// HISTORY FUNCTIONS
+int history_file_open();
+int history_file_map();
+void history_file_load_recent(int limit);
+void history_file_append(const char *line);
+size_t history_file_entry_length(size_t offset);
+int history_file_compare(const void *a, const void *b);
+void history_file_build_index();
+size_t history_file_lower_bound(const char *prefix, size_t prefix_len);
+long history_file_find_prefix(const char *prefix, long before, const char *skip);
+int history_prefix_search_command(int count, int key);
+void history_file_close();
+
+// COMPLETION FUNCTIONS
+char **complete_line(const char *text, int start, int end);
+char *completion_generator(const char *text, int state);
+int completing_command_word(int start);
+void complete_commands(const char *text);
+void complete_filenames(const char *text);
+void add_completion_match(const char *dir_part, size_t dir_len, const char *name, int is_dir);
+directory_listing_t *get_directory_listing(const char *path);
+directory_listing_t *read_directory_listing(const char *path, struct timespec *mtime);
+int compare_directory_entries(const void *a, const void *b);
+int directory_lower_bound(directory_listing_t *listing, const char *prefix, size_t prefix_len);
+void free_directory_listing(directory_listing_t *listing);
+void free_directory_cache();
+
+// OUTPUT CAPTURE FUNCTIONS
+int start_output_capture(job_t *job);
+void drain_output_ring(output_ring_t *ring);
+void drain_output_rings();
+void wait_in_foreground_capturing(job_t *job);
+void free_output_rings();
+
+// COPROCESS FUNCTIONS
+int start_coproc_pool(char *name, int worker_count, char *argv[]);
+coproc_pool_t *find_coproc_pool(const char *name);
+coproc_worker_t *find_coproc_worker(int fd);
+coproc_worker_t *find_idle_worker(coproc_pool_t *pool);
+int coproc_workers_alive(coproc_pool_t *pool);
+void read_coproc_output(int fd);
+void read_coproc_worker(coproc_worker_t *worker);
+void close_coproc_worker(coproc_worker_t *worker);
+void print_coproc_responses();
+void print_coproc_worker(coproc_worker_t *worker);
+void release_coproc_pool(job_t *job);
+
+// JOB CGROUP FUNCTIONS
+void open_job_cgroup(job_t *job);
+void write_cgroup_limit(job_t *job, const char *file, const char *env_name);
+pid_t clone_into_cgroup(job_t *job, int *pidfd);
+int read_cgroup_usage(job_t *job);
+void close_job_cgroup(job_t *job);
+
+// RESULT CACHE FUNCTIONS
+int parse_cache_keyword(job_t *job, int ind, int token_count, token_t tokens[], char *buffer);
+int job_output_fd(job_t *job);
+int replay_cached_result(job_t *job);
+void build_cache_key(job_t *job);
+int cache_watches_unchanged(char **paths, struct timespec *mtimes, int count);
+void read_cached_output(job_t *job);
+void finish_cached_result(job_t *job);
+void store_cached_result(job_t *job);
+void push_cache_entry(result_cache_entry_t *entry);
+void unlink_cache_entry(result_cache_entry_t *entry);
+void free_cache_entry(result_cache_entry_t *entry);
+void release_cache_request(job_t *job);
+void free_result_cache();
+
+// PARALLEL QUEUE FUNCTIONS
+char *build_parallel_command(char *words[], int word_count, const char *arg);
+void parallel_enqueue(char *command);
+void start_parallel_jobs();
+void finish_parallel_jobs();
+void free_parallel_queue();
+
+// ARENA FUNCTIONS
+arena_t *acquire_arena();
+void release_arena(arena_t *arena);
+void *arena_alloc(arena_t *arena, size_t size);
+char *arena_strdup(arena_t *arena, const char *str);
+char *arena_strndup(arena_t *arena, const char *str, size_t len);
+void arena_reset(arena_t *arena);
+void arena_destroy(arena_t *arena);
+
+// SESSION FUNCTIONS
+void exit_shell(int status) __attribute__((noreturn));
+void print_session_summary();
+void note_startup_phase(const char *phase);
+void finish_startup();
+
+// TRACING FUNCTIONS
+#ifdef YASH_TRACE
+void init_trace();
+void trace_event(const char *name, char phase, pid_t pid, int value);
+void flush_trace();
+void write_trace_events();
+void finish_trace();
+#endif
+
+// FUZZING FUNCTIONS
+#ifdef YASH_FUZZ
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+#ifdef YASH_FUZZ_DRIVER
+int fuzz_input_fd(int fd);
+int fuzz_input_path(const char *path);
+#endif
+#endif
+
+// STRESS TEST FUNCTIONS
+#ifdef YASH_STRESS
+int stress_job_table_round(int round, pid_t *next_pid);
+#endif
 
 // DEBUGGING FUNCTIONS
 void print_parsed_command_debug(char *buffer[]);
@@ -111,976 +911,6992 @@ void print_process_debug(process_t *process);
 
 // MISC SINGLETONS - IMPORTANT FOR TERMINAL CONTROL
 pid_t shell_pid;
+int spawn_mode;
+
+// SCRIPT/BATCH MODE - without a terminal there is no readline, no job control and no notifications
+int interactive;
+script_reader_t script_reader;
+
+// BUILTIN DISPATCH TABLE - looked up by argv[0] before a job is ever spawned
+builtin_t builtins[] = {
+    {FOREGROUND, execute_fg},
+    {BACKGROUND, execute_bg},
+    {JOBS, execute_jobs},
+    {HASH, execute_hash},
+    {PARALLEL, execute_parallel},
+    {WAIT, execute_wait},
+    {HISTORY, execute_history},
+    {OUTPUT, execute_output},
+    {CACHE_KEYWORD, execute_cache},
+    {ULIMIT, execute_ulimit},
+    {COPROC, execute_coproc},
+    {SEND, execute_send},
+    {"cd", execute_cd},
+    {"pwd", execute_pwd},
+    {"echo", execute_echo},
+    {"true", execute_true},
+    {"false", execute_false},
+    {"export", execute_export},
+    {"unset", execute_unset},
+    {"exit", execute_exit},
+    {"test", execute_test},
+    {"[", execute_test},
+};
+#define BUILTIN_COUNT ((int)(sizeof(builtins) / sizeof(builtins[0])))
+
+// exit status of the last foreground job or builtin
+int last_exit_status;
+
+// SESSION ACCOUNTING
+int session_summary;
+int session_jobs_run;
+struct timespec session_start_time;
+
+// STARTUP STATS
+int startup_stats;
+struct timespec startup_phase_start;
+
+// resolved command paths, shared by every spawn
+command_cache_t command_cache;
+
+// the arena of the last freed job, kept around so the next command can reuse it
+arena_t *spare_arena;
+
+// commands queued by the parallel builtin
+parallel_queue_t parallel_queue;
+
+// persistent history, only opened by interactive shells
+history_file_t history_file = {.fd = -1};
+
+// OUTPUT CAPTURE STATE - rings indexed by job number
+output_ring_t **output_rings;
+int output_ring_capacity;
+int active_output_rings; // rings whose pipe is still open
 
-int main(int argc, char const *argv)
+// the resources ulimit knows, the first one is what a bare ulimit shows
+ulimit_resource_t ulimit_resources[] = {
+    {'f', RLIMIT_FSIZE, 1024, "file size (kbytes)"},
+    {'c', RLIMIT_CORE, 1024, "core file size (kbytes)"},
+    {'d', RLIMIT_DATA, 1024, "data seg size (kbytes)"},
+    {'m', RLIMIT_RSS, 1024, "max memory size (kbytes)"},
+    {'n', RLIMIT_NOFILE, 1, "open files"},
+    {'s', RLIMIT_STACK, 1024, "stack size (kbytes)"},
+    {'t', RLIMIT_CPU, 1, "cpu time (seconds)"},
+    {'u', RLIMIT_NPROC, 1, "max user processes"},
+    {'v', RLIMIT_AS, 1024, "virtual memory (kbytes)"},
+};
+#define ULIMIT_RESOURCE_COUNT ((int)(sizeof(ulimit_resources) / sizeof(ulimit_resources[0])))
+
+// COPROCESS STATE
+coproc_pool_t *coproc_pools;
+int coproc_output_ready; // some worker wrote a full line (or exited) since the last print_coproc_responses
+
+// JOB CGROUP STATE
+int cgroup_jobs_created;
+int clone3_unavailable; // clone3 can't do CLONE_INTO_CGROUP here, children move themselves into their cgroup from then on
+
+// outputs of cached pipelines
+result_cache_t result_cache;
+
+// COMPLETION STATE
+directory_listing_t *directory_cache;
+int directory_cache_count;
+// the candidates of the current TAB, handed to readline one by one through completion_generator
+char **completion_candidates;
+int completion_candidate_count;
+int completion_candidate_capacity;
+
+// TRACING STATE
+#ifdef YASH_TRACE
+// only the shell itself records, a vfork child shares this memory and must never touch it
+trace_event_t trace_buffer[TRACE_BUFFER_EVENTS];
+int trace_buffered;
+FILE *trace_file; // NULL when YASH_TRACE isn't set, and every event is dropped right away
+int trace_events_written;
+#endif
+
+// EVENT LOOP STATE
+int sigchld_fd = -1;
+int event_fd = -1; // one epoll set for the terminal, SIGCHLD, every pidfd and the capture pipes
+int pidfd_unavailable; // pidfd_open failed with ENOSYS once, jobs are only tracked through SIGCHLD from then on
+const char *active_prompt = TERMINAL_PROMPT;
+int background_jobs_done;
+char *pending_command;
+int command_ready;
+volatile sig_atomic_t wait_interrupted;
+
+// SERVER STATE
+char *server_socket_path; // set by --listen, the shell is a server instead of reading commands
+int server_fd = -1;
+server_client_t *server_clients;
+
+// fuzzer and stress builds bring their own main, see LLVMFuzzerTestOneInput and stress_job_table_round
+#if !defined(YASH_FUZZ) && !defined(YASH_STRESS)
+int main(int argc, char *argv[])
 {
-    /* since we're emulating the shell, we want it to ignore being terminated or stopped.
-    If any background process tries to write to the
-    */
-    signal(SIGINT, SIG_IGN);
-    signal(SIGTSTP, SIG_IGN);
-    signal(SIGTTOU, SIG_IGN); // only allow pg in control of the fg to write to terminal
-    signal(SIGTTIN, SIG_IGN);
+    clock_gettime(CLOCK_MONOTONIC, &session_start_time);
+    startup_phase_start = session_start_time;
+    // pick where commands come from: a script file, a -c string, or stdin (interactive only if it is a terminal)
+    if (parse_arguments(argc, argv) < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    note_startup_phase("arguments");
+
+    if (interactive)
+    {
+        /* since we're emulating the shell, we want it to ignore being terminated or stopped.
+        If any background process tries to write to the
+        */
+        signal(SIGINT, SIG_IGN);
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGTTOU, SIG_IGN); // only allow pg in control of the fg to write to terminal
+        signal(SIGTTIN, SIG_IGN);
+    }
 
     shell_pid = getpid();
+#ifdef YASH_TRACE
+    init_trace();
+#endif
+    session_summary = (getenv(SESSION_SUMMARY_ENV) != NULL);
+
+    // children are spawned with vfork unless fork is explicitly requested (useful for benchmarking both paths)
+    char *requested_spawn_mode = getenv(SPAWN_MODE_ENV);
+    spawn_mode = (requested_spawn_mode != NULL && strcmp(requested_spawn_mode, "fork") == 0) ? SPAWN_MODE_FORK : SPAWN_MODE_VFORK;
 
     /* here, we want to set the pg containing the shell process to the pid of the shell process
     this is done so that we can restore terminal control to the shell later on
     */
-    if (setpgid(0, 0) < 0)
+    if (interactive && setpgid(0, 0) < 0)
     {
         perror("Error when setting pg for shell");
         exit(1);
     }
 
-    // initialize job linked list
-    job_list_head = NULL;
+    note_startup_phase("setup");
+
+    // initialize job table
+    init_job_table();
+    note_startup_phase("job_table");
+
+    // SIGCHLD is delivered through a signalfd so children are reaped as soon as their status changes
+    if (init_child_notifications() < 0)
+    {
+        perror("Error when setting up SIGCHLD notifications");
+    }
+    note_startup_phase("child_notifications");
 
-    tcsetpgrp(STDIN_FILENO, shell_pid);
+    if (interactive)
+    {
+        tcsetpgrp(STDIN_FILENO, shell_pid);
+        // readline and the history file are only set up at the first prompt, see init_line_editor
+    }
+    else
+    {
+        finish_startup();
+    }
+    if (server_socket_path != NULL)
+    {
+        run_server(server_socket_path);
+    }
 
     while (1)
     {
         // running updates for status updates on processes (since we are using a different pattern)
         update_job_table_statuses();
 
-        // get input from the user
-        char *command = readline(TERMINAL_PROMPT);
+        // get input from the user (or the next line of the script)
+        size_t command_len;
+        char *command = interactive ? read_command(TERMINAL_PROMPT) : read_script_line(&script_reader, &command_len);
 
         // this is how we exit the command line with Ctrl-D (it sends an EOF to the readline command)
         if (command == NULL)
         {
-            free(command);
-            free_job_table();
-            exit(EXIT_SUCCESS);
+            if (!interactive)
+            {
+                finish_parallel_jobs();
+            }
+            exit_shell(last_exit_status);
         }
-        char *command_copy = strdup(command);
-        char *tokenized_command[MAX_ARGS];
-        int tokenized_command_length = parse_command(command_copy, tokenized_command);
-
-        if (tokenized_command_length == 0)
+        if (interactive)
         {
-            free(command);
-            free(command_copy);
-            // print DONE jobs
-            print_job_table(0, 0, 1);
-            remove_done_jobs();
-            continue;
+            command_len = strlen(command);
+            history_file_append(command);
         }
-
-        // check for the execution of custom commands
-        if (execute_custom_commands(command))
+        job_t *job = parse_job_line(command, command_len);
+        if (interactive)
         {
             free(command);
-            free(command_copy);
-            // print DONE jobs
-            print_job_table(0, 0, 1);
-            remove_done_jobs();
-            continue;
-        }
-
-        job_t *job = (job_t *)malloc(sizeof(job_t));
-        memset(job, 0, sizeof(job_t));
-        job->command = command;
-        int processing_status = process_input(tokenized_command_length, tokenized_command, job);
-
-        if (processing_status == COMMAND_PROCESSING_ERROR)
-        {
-
-            free(command_copy);
-            free_job(job);
-            // print DONE jobs
-            print_job_table(0, 0, 1);
-            remove_done_jobs();
-            continue;
         }
-        execute_job(job);
+        read_here_documents(job);
+        // every job of the line runs before the DONE jobs are printed and cleaned up
+        execute_job_list(job);
         update_job_table_statuses();
-        print_job_table(0, 0, 1);
-        remove_done_jobs();
-        free(command_copy);
+        print_coproc_responses();
+        report_done_jobs();
     }
 
     return 0;
 }
+#endif
 
 // ==== COMMAND LINE PARSING / INTERPRETATION ==== //
 
-int parse_command(char *command, char *buffer[])
+job_t *parse_job_line(char *command, size_t len)
 {
-    int ind = 0;
-    char *token = strtok(command, COMMAND_DELIMETER);
-    while (token != NULL)
+    // everything parsed from this line lives in the arenas of its jobs from here on, NULL for empty or invalid lines
+    // the line is lexed once, then every part separated by ;, && or || (or ended by a & with more to come) becomes a job
+    // a NUL read from a script ends the line, the working copy and the slices of it are cut at the same place
+    len = strnlen(command, len);
+    job_t *job = create_job(command, len);
+    // job->command is kept intact for the job table, the tokens are cut out of a working copy
+    char *command_copy = arena_strdup(job->arena, job->command);
+    // filled in by the lexer for every character it keeps, expand_words needs to know what was quoted
+    char *quoting = (char *)arena_alloc(job->arena, len + 1);
+    token_t tokens[MAX_ARGS];
+    TRACE_BEGIN("parse_command");
+    int token_count = parse_command(command_copy, quoting, tokens, MAX_ARGS);
+    TRACE_END("parse_command", -1);
+    if (token_count <= 0)
     {
-        buffer[ind] = token;
-        ind++;
-        token = strtok(NULL, COMMAND_DELIMETER);
+        free_job(job);
+        return NULL;
     }
-    // ensure list is null terminated
-    buffer[ind] = NULL;
-    return ind;
-}
-
-int process_input(int tokenized_command_length, char *tokenized_command[], job_t *job)
-{
-    process_t *process;
-    int ind = 0;
-    int argv_ind = 0;
-    int creating_second_process = 0;
-
-    process = (process_t *)malloc(sizeof(process_t));
-    memset(process, 0, sizeof(process_t));
-
-    while (ind < tokenized_command_length)
+    job_t *first = NULL;
+    job_t **next_job = &first;
+    enum token_type list_operator = TOKEN_SEQUENCE;
+    int start = 0;
+    for (int ind = 0; ind <= token_count; ind++)
     {
-        if (strcmp(tokenized_command[ind], INPUT_REDIRECT) == 0)
-        {
-            // check that it is not the first or last last string
-            if ((argv_ind == 0) || (ind + 1 == tokenized_command_length))
-            {
-                // free_process(process);
-                printf("Error [process_input]: < needs to be placed between two tokens\n");
-                return COMMAND_PROCESSING_ERROR;
-            }
-            // don't put redirect symbol or filename into arguments
-            process->redirect_input_filename = strdup(tokenized_command[++ind]);
-        }
-        else if (strcmp(tokenized_command[ind], OUTPUT_REDIRECT) == 0)
+        enum token_type type = (ind < token_count) ? tokens[ind].type : TOKEN_SEQUENCE;
+        int background = (type == TOKEN_BACKGROUND && ind + 1 < token_count);
+        if (type != TOKEN_SEQUENCE && type != TOKEN_AND && type != TOKEN_OR && !background)
         {
-            // check that it is not the first or last last string
-            if ((argv_ind == 0) || (ind + 1 == tokenized_command_length))
-            {
-                free_process(process);
-                printf("Error [process_input]: > needs to be placed between two command tokens\n");
-                return COMMAND_PROCESSING_ERROR;
-            }
-            process->redirect_output_filename = strdup(tokenized_command[++ind]);
+            continue;
         }
-        else if (strcmp(tokenized_command[ind], ERROR_REDIRECT) == 0)
+        // the & stays with its part, process_input turns it into a background job
+        int end = background ? ind + 1 : ind;
+        if (end == start)
         {
-            // check that it is not the first or last last string
-            if ((argv_ind == 0) || (ind + 1 == tokenized_command_length))
+            // only a line ending in ; or & may have nothing after its last operator
+            if (ind == token_count && start > 0 && (tokens[start - 1].type == TOKEN_SEQUENCE || tokens[start - 1].type == TOKEN_BACKGROUND))
             {
-                free_process(process);
-                printf("Error [process_input]: 2> needs to be placed between two command tokens\n");
-                return COMMAND_PROCESSING_ERROR;
+                break;
             }
-            process->redirect_error_filename = strdup(tokenized_command[++ind]);
-        }
-        else if (strcmp(tokenized_command[ind], PIPE) == 0)
-        {
-            if ((argv_ind == 0) || (ind + 1 == tokenized_command_length))
+            printf("Error [parse_job_line]: %s needs to be placed between two commands\n", token_type_str((ind < token_count) ? type : tokens[start - 1].type));
+            free_job_list(first);
+            if (job != NULL)
             {
-                free_process(process);
-                printf("Error [process_input]: | needs to be placed between two command tokens\n");
-                return COMMAND_PROCESSING_ERROR;
+                free_job(job);
             }
-            // point job first process to this process
-            job->first_process = process;
-
-            // create a new process and reset the argv counter
-            process = (process_t *)malloc(sizeof(process_t));
-            memset(process, 0, sizeof(process_t));
-            argv_ind = -1;
-
-            // set creating second process
-            creating_second_process = 1;
-
-            // don't put pipe symbol into any argv
+            return NULL;
         }
-        else if (strcmp(tokenized_command[ind], SEND_TO_BACKGROUND) == 0)
+        // the first part reuses the job (and working copy) the line was lexed in
+        job_t *part = parse_list_part(job, command, len, command_copy, quoting, tokens, start, end, token_count);
+        if (part == NULL)
         {
-            // check that if found it is the last character - error
-            if ((ind == 0) || ind + 1 < tokenized_command_length)
-            {
-                free_process(process);
-                printf("Error [process_input]: & cannot be the only command, and can only be placed at the end of a command\n");
-                return COMMAND_PROCESSING_ERROR;
-            }
-            job->background = 1;
+            free_job_list(first);
+            return NULL;
         }
-        else
+        job = NULL;
+        part->list_operator = list_operator;
+        *next_job = part;
+        next_job = &part->list_next;
+        list_operator = background ? TOKEN_SEQUENCE : type;
+        start = ind + 1;
+    }
+    return first;
+}
+
+job_t *parse_list_part(job_t *job, char *command, size_t len, char *command_copy, char *quoting, token_t tokens[], int start, int end, int token_count)
+{
+    // builds the job for tokens [start, end) of the lexed line, freeing the job it was given on errors
+    if (start == 0 && end == token_count)
+    {
+        // a line with a single job, parsed in place like before there were lists
+        keep_lexed_words(job, command_copy, quoting, tokens, token_count);
+        TRACE_BEGIN("process_input");
+        int processed = process_input(token_count, tokens, command_copy, job);
+        TRACE_END("process_input", -1);
+        if (processed == COMMAND_PROCESSING_ERROR)
         {
-            process->argv[argv_ind] = strdup(tokenized_command[ind]);
+            free_job(job);
+            return NULL;
         }
-        ind++;
-        argv_ind++;
+        return job;
     }
-
-    if (!creating_second_process)
+    // the part's source text ends at the operator after it, its lexed words end by then too (the NUL may sit on the operator)
+    int source_start = tokens[start].offset;
+    int source_end = (end < token_count) ? tokens[end].offset : (int)len;
+    if (tokens[end - 1].type == TOKEN_BACKGROUND)
     {
-        job->first_process = process;
+        source_end = tokens[end - 1].offset + tokens[end - 1].length;
     }
-    else
+    while (source_end > source_start && (command[source_end - 1] == ' ' || command[source_end - 1] == '\t'))
     {
-        job->second_process = process;
+        source_end--;
     }
-    return SUCCESS;
-}
-
-// ==== PROCESS LAUNCHING ==== //
-void execute_job(job_t *job)
-{
-    int pgid = -1;
-    // check if you need to launch a piped process or a single process
-    if (job->first_process != NULL && job->second_process != NULL)
+    if (job == NULL)
     {
-        pgid = execute_pipe_process(job);
+        job = create_job(command + source_start, source_end - source_start);
     }
     else
     {
-        pgid = execute_process(job);
+        job->command = arena_strndup(job->arena, command + source_start, source_end - source_start);
     }
-
-    // update controlling job
-    job->pgid = pgid;
-    job->status = RUNNING;
-    if (job->background)
+    // the other parts get their own copy of their slice of the lexed line, the first one stays in the working copy
+    int slice_start = (start == 0) ? 0 : source_start;
+    char *buffer = command_copy;
+    if (slice_start > 0)
     {
-        job->job_number = find_most_recent_job_num() + 1;
+        size_t slice_length = ((end < token_count) ? tokens[end].offset : (int)len) + 1 - slice_start;
+        buffer = (char *)arena_alloc(job->arena, slice_length);
+        memcpy(buffer, command_copy + slice_start, slice_length);
     }
-    else
+    token_t part_tokens[MAX_ARGS];
+    for (int ind = start; ind < end; ind++)
     {
-        job->job_number = FG_JOB_NUM;
+        part_tokens[ind - start] = tokens[ind];
+        part_tokens[ind - start].offset -= slice_start;
     }
-
-    add_job(job);
-
-    // delegate job to being registered in the foreground or background
-    if (!job->background)
+    // the quoting of the whole line belongs to the first part, which is freed once it ran
+    char *part_quoting = quoting;
+    if (slice_start > 0)
     {
-        execute_in_foreground(job);
+        part_quoting = (char *)arena_alloc(job->arena, source_end - source_start + 1);
+        memcpy(part_quoting, quoting + slice_start, source_end - source_start + 1);
     }
-    // else we continue on with execution, given that the process is now successfully running in the background
+    keep_lexed_words(job, buffer, part_quoting, part_tokens, end - start);
+    TRACE_BEGIN("process_input");
+    int processed = process_input(end - start, part_tokens, buffer, job);
+    TRACE_END("process_input", -1);
+    if (processed == COMMAND_PROCESSING_ERROR)
+    {
+        free_job(job);
+        return NULL;
+    }
+    return job;
 }
 
-int execute_process(job_t *job)
+void free_job_list(job_t *job)
 {
-    int pid = fork();
-    if (pid < 0)
+    // the jobs of a line that never ran
+    while (job != NULL)
     {
-        exit(EXIT_FAILURE);
+        job_t *next = job->list_next;
+        free_job(job);
+        job = next;
     }
-    if (pid == 0)
-    {
-        // signal stuff
-        signal(SIGINT, SIG_DFL);
-        signal(SIGTSTP, SIG_DFL);
-        signal(SIGTTOU, SIG_IGN);
-        // assign child to its own process group
-        setpgid(0, 0);
+}
 
-        // check if you need to launch in the foreground or the background (need to set tcgrep thing)
-        if (!job->background)
+int parse_command(char *command, char *quoting, token_t tokens[], int max_tokens)
+{
+    // single pass lexer: words are unquoted and NUL terminated in place, operators are classified by their first character
+    // the terminating NUL of a word may overwrite the character after it, so the lexer always carries that character in c
+    int count = 0;
+    char *read = command;
+    char c = *read;
+    while (1)
+    {
+        while (c == ' ' || c == '\t')
         {
-            // have to set as pid since pid==pgid, and job->pgid may not be set yet due to race conditions
-            tcsetpgrp(STDIN_FILENO, pid);
+            c = *++read;
         }
-
-        int redirects_status = apply_file_redirects(job->first_process);
-        if (redirects_status == FILE_REDIRECTION_ERROR)
+        if (c == '\0' || c == COMMENT_CHAR)
         {
-            exit(EXIT_FAILURE);
+            // the rest of the line is a comment (this also skips a script's #! line)
+            break;
         }
-        // means we're good to execvp
-        process_t *process = job->first_process;
-        if (execvp(process->argv[0], process->argv) < 0)
+        if (count == max_tokens)
         {
-            if (process->redirect_error_filename != NULL)
-            {
-                exit(EXIT_FAILURE);
-            }
+            printf("Error [parse_command]: commands are limited to %d tokens\n", max_tokens);
+            return INPUT_PARSING_ERROR;
         }
-        exit(EXIT_FAILURE);
-    }
-    return pid;
-}
-
-int execute_pipe_process(job_t *job)
-{
-    int pgid = fork();
-    if (pgid < 0)
-    {
-        exit(EXIT_FAILURE);
-    }
-    if (pgid == 0)
-    {
-        // signal stuff to be inherited by children
-        signal(SIGINT, SIG_DFL);
-        signal(SIGTSTP, SIG_DFL);
-        // we want children processes to be able to write to the terminal if the pg is in the foreground
-        signal(SIGTTOU, SIG_DFL);
-        signal(SIGTTIN, SIG_IGN);
-
-        setpgid(0, 0);
+        token_t *token = &tokens[count++];
+        token->offset = read - command;
+        token->quoted = 0;
+        token->expand = 0;
 
-        // setting process to be either in foreground or background
-        if (!job->background)
+        int operator_length = lex_redirect(read, c, token);
+        if (operator_length > 0)
         {
-            // have to set as pid since pid==pgid, and job->pgid may not be set yet due to race conditions
-            tcsetpgrp(STDIN_FILENO, pgid);
-        }
-
-        // create fd for pipe
-        int pipe_fd[2];
-        int pipe_creation_status = pipe(pipe_fd);
-        if (pipe_creation_status < 0)
-        {
-            exit(EXIT_FAILURE);
+            read += operator_length;
+            c = *read;
+            continue;
         }
-        // first process
-        int pid1 = fork();
-        if (pid1 < 0)
+        token->type = classify_operator(c, read[1], &operator_length);
+        if (token->type == TOKEN_HERE_DOCUMENT && read[2] == '<')
         {
-            exit(EXIT_FAILURE);
+            token->type = TOKEN_HERE_STRING;
+            operator_length = 3;
         }
-        if (pid1 == 0)
+        if (token->type == TOKEN_INPUT_SUBSTITUTION || token->type == TOKEN_OUTPUT_SUBSTITUTION)
         {
-            // assign this child process to pg of parent process!
-            // setpgid(0, pgid); // may have to disable this for SIGNALS TO BE RECIEVED BY CHILDREN
-            // apply pipe stdout redirection
-            close(pipe_fd[0]);
-            dup2(pipe_fd[1], STDOUT_FILENO);
-            close(pipe_fd[1]);
-
-            // apply file redirects
-            int redirects_status = apply_file_redirects(job->first_process);
-            if (redirects_status == FILE_REDIRECTION_ERROR)
+            // <(cmd) and >(cmd) take everything up to the matching parenthesis, the yash -c running cmd lexes it again
+            char *end = read + 2;
+            char quote = '\0';
+            for (int depth = 1; *end != '\0'; end++)
             {
-                // terminate the program if any file redirections encountered
-                exit(EXIT_FAILURE);
-            }
-            // means we're good to execvp
-            process_t *process = job->first_process;
-            if (execvp(process->argv[0], process->argv) < 0)
-            {
-                if (process->redirect_error_filename != NULL)
+                if (quote != '\0')
+                {
+                    quote = (*end == quote) ? '\0' : quote;
+                }
+                else if (*end == '\'' || *end == '"')
+                {
+                    quote = *end;
+                }
+                else if (*end == '(')
+                {
+                    depth++;
+                }
+                else if (*end == ')' && --depth == 0)
                 {
-                    exit(EXIT_FAILURE);
+                    break;
                 }
             }
-            exit(EXIT_FAILURE);
+            if (*end == '\0')
+            {
+                printf("Error [parse_command]: unterminated %s\n", token_type_str(token->type));
+                return INPUT_PARSING_ERROR;
+            }
+            // the token is the command without its parentheses
+            *end = '\0';
+            token->offset += 2;
+            token->length = end - (command + token->offset);
+            read = end + 1;
+            c = *read;
+            continue;
         }
-        // second process
-        int pid2 = fork();
-        if (pid2 < 0)
+        if (token->type != TOKEN_WORD)
         {
-            exit(EXIT_FAILURE);
+            token->length = operator_length;
+            read += operator_length;
+            c = *read;
+            continue;
         }
-        if (pid2 == 0)
+
+        // word: copy it down over its own quotes and backslashes
+        char *write = read;
+        while (c != '\0' && c != ' ' && c != '\t' && classify_operator(c, read[1], &operator_length) == TOKEN_WORD)
         {
-            // assign this child process to pg of parent process!
-            // setpgid(0, pgid); // may have to disable this for SIGNALS TO BE RECIEVED BY CHILDREN
-            // apply pipe stdin redirection
-            close(pipe_fd[1]);
-            dup2(pipe_fd[0], STDIN_FILENO);
-            close(pipe_fd[0]);
-            // apply file redirects
-            int redirects_status = apply_file_redirects(job->second_process);
-            if (redirects_status == FILE_REDIRECTION_ERROR)
+            if (c == '\'' || c == '"')
             {
-                // terminate the program if any file redirections encountered
-                exit(EXIT_FAILURE);
+                char quote = c;
+                token->quoted = 1;
+                read++;
+                while (*read != '\0' && *read != quote)
+                {
+                    // inside double quotes a backslash only escapes the characters that are special there
+                    quoting[write - command] = (quote == '"') ? CHAR_DOUBLE_QUOTED : CHAR_LITERAL;
+                    if (quote == '"' && *read == '\\' && (read[1] == '"' || read[1] == '\\' || read[1] == '$' || read[1] == '`'))
+                    {
+                        quoting[write - command] = CHAR_LITERAL;
+                        read++;
+                    }
+                    else if (quote == '"' && *read == '$')
+                    {
+                        token->expand |= EXPAND_VARIABLES;
+                    }
+                    *write++ = *read++;
+                }
+                if (*read == '\0')
+                {
+                    printf("Error [parse_command]: unterminated %c quote\n", quote);
+                    return INPUT_PARSING_ERROR;
+                }
+                read++;
+            }
+            else if (c == '\\' && read[1] != '\0')
+            {
+                token->quoted = 1;
+                read++;
+                quoting[write - command] = CHAR_LITERAL;
+                *write++ = *read++;
             }
-            // means we're good to execvp
-            process_t *process = job->second_process;
-            if (execvp(process->argv[0], process->argv) < 0)
+            else
             {
-                if (process->redirect_error_filename != NULL)
+                if (c == '$')
                 {
-                    exit(EXIT_FAILURE);
+                    token->expand |= EXPAND_VARIABLES;
                 }
+                else if (c == '~' && write == command + token->offset)
+                {
+                    token->expand |= EXPAND_TILDE;
+                }
+                else if (strchr(GLOB_CHARS, c) != NULL)
+                {
+                    token->expand |= EXPAND_GLOB;
+                }
+                quoting[write - command] = CHAR_UNQUOTED;
+                *write++ = *read++;
             }
-            exit(EXIT_FAILURE);
+            c = *read;
         }
-        close(pipe_fd[0]);
-        close(pipe_fd[1]);
-
-        // wait for each process to be done, not stopped! (need to wait for both because the left may be a sleep!)
-        waitpid(pid1, NULL, 0);
-        waitpid(pid2, NULL, 0);
-        // terminate the process naturally to inform shell of completion
-        exit(EXIT_SUCCESS);
+        token->length = write - (command + token->offset);
+        *write = '\0';
     }
-    return pgid;
+    return count;
 }
 
-void execute_in_foreground(job_t *job)
+enum token_type classify_operator(char c, char next, int *length)
 {
-    int status;
-    pid_t pid;
-
-    // have to set this due to race conditions (the shell may reach foreground execution before the child has the chance to tcsetgrp)
-    tcsetpgrp(STDIN_FILENO, job->pgid);
-    do
+    *length = 1;
+    switch (c)
     {
-        pid = waitpid(-1, &status, WUNTRACED);
-    } while (update_job_status(status, pid) && (job->status == RUNNING));
-    tcsetpgrp(STDIN_FILENO, shell_pid);
+    case ';':
+        return TOKEN_SEQUENCE;
+    case '<':
+        if (next == '|')
+        {
+            *length = 2;
+            return TOKEN_SPLICE_REDIRECT;
+        }
+        if (next == '<')
+        {
+            // <<< is told apart by the lexer, which can look one character further
+            *length = 2;
+            return TOKEN_HERE_DOCUMENT;
+        }
+        if (next == '(')
+        {
+            *length = 2;
+            return TOKEN_INPUT_SUBSTITUTION;
+        }
+        // the redirects themselves are lexed by lex_redirect, this only ends the word in front of them
+        return TOKEN_REDIRECT;
+    case '>':
+        if (next == '(')
+        {
+            *length = 2;
+            return TOKEN_OUTPUT_SUBSTITUTION;
+        }
+        return TOKEN_REDIRECT;
+    case '|':
+        if (next == '|')
+        {
+            *length = 2;
+            return TOKEN_OR;
+        }
+        return TOKEN_PIPE;
+    case '&':
+        if (next == '&')
+        {
+            *length = 2;
+            return TOKEN_AND;
+        }
+        return TOKEN_BACKGROUND;
+    default:
+        return TOKEN_WORD;
+    }
 }
 
-void continue_background_job(job_t *job, int fg)
+int lex_redirect(const char *read, char c, token_t *token)
 {
-    // make sure to turn off notifications for this job when it finishes in foreground!
-    // by default foreground jobs will not start off with the notification flag
-    int kill_signal_sent_status = kill(-job->pgid, SIGCONT);
-    if (kill_signal_sent_status < 0)
+    // [n]<, [n]>, [n]>>, [n]<&, [n]>&, &> and &>> at the start of a token: returns their length, 0 for anything else
+    // the fd only counts when the digit stands on its own (a2>f is the word a2 redirected to f)
+    int fd = -1;
+    int length = 0;
+    if (c >= '0' && c <= '9' && (read[1] == '<' || read[1] == '>'))
     {
-        job->status = STOPPED;
-        return;
+        fd = c - '0';
+        length = 1;
+        c = read[1];
     }
-    if (fg)
+    char next = read[length + 1];
+    token->redirect_both = 0;
+    if (c == '&' && next == '>' && fd < 0)
     {
-        execute_in_foreground(job);
+        token->redirect_both = 1;
+        token->redirect_type = (read[2] == '>') ? REDIRECT_APPEND : REDIRECT_WRITE;
+        token->symbol = (read[2] == '>') ? BOTH_APPEND_REDIRECT : BOTH_REDIRECT;
+        length = (read[2] == '>') ? 3 : 2;
+        fd = STDOUT_FILENO;
     }
-    // else we continue on with execution, given that the process is now successfully running in the background
+    else if (c == '>' && (next != '(' || fd >= 0))
+    {
+        token->redirect_type = (next == '>') ? REDIRECT_APPEND : (next == '&') ? REDIRECT_DUPLICATE : REDIRECT_WRITE;
+        token->symbol = (next == '>') ? APPEND_REDIRECT : (next == '&') ? DUPLICATE_OUTPUT : OUTPUT_REDIRECT;
+        length += (next == '>' || next == '&') ? 2 : 1;
+        fd = (fd < 0) ? STDOUT_FILENO : fd;
+    }
+    else if (c == '<' && (fd >= 0 || (next != '<' && next != '|' && next != '(')))
+    {
+        // <<, <| and <( are operators of their own
+        token->redirect_type = (next == '&') ? REDIRECT_DUPLICATE : REDIRECT_READ;
+        token->symbol = (next == '&') ? DUPLICATE_INPUT : INPUT_REDIRECT;
+        length += (next == '&') ? 2 : 1;
+        fd = (fd < 0) ? STDIN_FILENO : fd;
+    }
+    else
+    {
+        return 0;
+    }
+    token->type = TOKEN_REDIRECT;
+    token->redirect_fd = fd;
+    token->length = length;
+    return length;
 }
 
-void print_file_redirection_error_str(char *filename)
+const char *token_type_str(enum token_type type)
 {
-    int len = strlen(filename);
-    char *error_str = (char *)malloc((100 + len) * sizeof(char));
-    memset(error_str, '\0', (len + 100) * sizeof(char));
-    sprintf(error_str, "-yash: %s: No such file or directory", filename);
-    perror(error_str);
-    free(error_str);
+    switch (type)
+    {
+    case TOKEN_REDIRECT:
+        return "redirect";
+    case TOKEN_PIPE:
+        return PIPE;
+    case TOKEN_SPLICE_REDIRECT:
+        return SPLICE_REDIRECT;
+    case TOKEN_BACKGROUND:
+        return SEND_TO_BACKGROUND;
+    case TOKEN_SEQUENCE:
+        return SEQUENCE;
+    case TOKEN_AND:
+        return AND_LIST;
+    case TOKEN_OR:
+        return OR_LIST;
+    case TOKEN_HERE_DOCUMENT:
+        return HERE_DOCUMENT;
+    case TOKEN_HERE_STRING:
+        return HERE_STRING;
+    case TOKEN_INPUT_SUBSTITUTION:
+        return INPUT_SUBSTITUTION;
+    case TOKEN_OUTPUT_SUBSTITUTION:
+        return OUTPUT_SUBSTITUTION;
+    default:
+        return "word";
+    }
 }
 
-int apply_file_redirects(process_t *process)
+int process_input(int token_count, token_t tokens[], char *buffer, job_t *job)
 {
-    // create and use dup while checking each of the file redirections
-    int status = 0;
-    if (process->redirect_error_filename != NULL)
+    process_t *process;
+    // where the next finished pipeline stage gets linked in
+    process_t **next_process = &job->first_process;
+    int argc = 0;
+    // prefix keywords (time, cache and its options) are only recognized before the first real word
+    int keyword_end = 0;
+
+    // words were NUL terminated in place by parse_command, so argv points straight into the buffer
+    process = create_process(job, count_stage_words(0, token_count, tokens));
+
+    for (int ind = 0; ind < token_count; ind++)
     {
-        int fd = open(process->redirect_error_filename, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
-        if (fd < 0)
+        token_t *token = &tokens[ind];
+        switch (token->type)
         {
-            status = -1;
-            print_file_redirection_error_str(process->redirect_error_filename);
+        case TOKEN_WORD:
+            if (ind == keyword_end && ind + 1 < token_count && !token->quoted && strcmp(buffer + token->offset, TIME_KEYWORD) == 0)
+            {
+                // time prefix keyword, reported once the whole job is done
+                job->timed = 1;
+                keyword_end = ind + 1;
+                break;
+            }
+            if (ind == keyword_end && ind + 1 < token_count && !token->quoted && strcmp(buffer + token->offset, CACHE_KEYWORD) == 0)
+            {
+                // cache prefix keyword, skips over its own options
+                ind = parse_cache_keyword(job, ind, token_count, tokens, buffer);
+                if (ind < 0)
+                {
+                    return COMMAND_PROCESSING_ERROR;
+                }
+                keyword_end = ind + 1;
+                break;
+            }
+            process->argv[argc++] = buffer + token->offset;
+            break;
+        case TOKEN_INPUT_SUBSTITUTION:
+        case TOKEN_OUTPUT_SUBSTITUTION:
+            if (argc == 0)
+            {
+                printf("Error [process_input]: %s needs to be placed after a command\n", token_type_str(token->type));
+                return COMMAND_PROCESSING_ERROR;
+            }
+            process->argv[argc++] = add_process_substitution(job, process, token, buffer);
+            break;
+        case TOKEN_HERE_DOCUMENT:
+        case TOKEN_HERE_STRING:
+        {
+            if ((argc == 0) || (ind + 1 == token_count) || (tokens[ind + 1].type != TOKEN_WORD))
+            {
+                printf("Error [process_input]: %s needs to be placed between two command tokens\n", token_type_str(token->type));
+                return COMMAND_PROCESSING_ERROR;
+            }
+            token_t *word = &tokens[++ind];
+            redirect_t *redirect = add_redirect(job, process, REDIRECT_HERE_DOCUMENT, STDIN_FILENO);
+            if (token->type == TOKEN_HERE_DOCUMENT)
+            {
+                // the text follows on the next lines, see read_here_documents
+                redirect->delimiter = buffer + word->offset;
+                redirect->from_lines = 1;
+                break;
+            }
+            // <<< word feeds the word and a newline
+            redirect->text = (char *)arena_alloc(job->arena, word->length + 2);
+            memcpy(redirect->text, buffer + word->offset, word->length);
+            redirect->text[word->length] = '\n';
+            redirect->text[word->length + 1] = '\0';
+            redirect->text_length = word->length + 1;
+            break;
         }
-        dup2(fd, STDERR_FILENO);
-        close(fd);
-    }
-    if (process->redirect_input_filename != NULL)
-    {
-        int fd = open(process->redirect_input_filename, O_RDONLY);
-        if (fd < 0)
+        case TOKEN_REDIRECT:
         {
-            status = -1;
-            print_file_redirection_error_str(process->redirect_input_filename);
+            // check that it is not the first or last token, and that a filename (or a process substitution) follows
+            if ((argc == 0) || (ind + 1 == token_count) ||
+                (tokens[ind + 1].type != TOKEN_WORD && tokens[ind + 1].type != TOKEN_INPUT_SUBSTITUTION && tokens[ind + 1].type != TOKEN_OUTPUT_SUBSTITUTION))
+            {
+                printf("Error [process_input]: %s needs to be placed between two command tokens\n", token->symbol);
+                return COMMAND_PROCESSING_ERROR;
+            }
+            // don't put redirect symbol or filename into arguments
+            ind++;
+            char *target = (tokens[ind].type == TOKEN_WORD) ? buffer + tokens[ind].offset : add_process_substitution(job, process, &tokens[ind], buffer);
+            if (add_redirect_token(job, process, token, target) == COMMAND_PROCESSING_ERROR)
+            {
+                return COMMAND_PROCESSING_ERROR;
+            }
+            break;
+        }
+        case TOKEN_SPLICE_REDIRECT:
+        {
+            if ((argc == 0) || (ind + 1 == token_count) || (tokens[ind + 1].type != TOKEN_WORD))
+            {
+                printf("Error [process_input]: %s needs to be placed between two command tokens\n", SPLICE_REDIRECT);
+                return COMMAND_PROCESSING_ERROR;
+            }
+            if (next_process != &job->first_process)
+            {
+                printf("Error [process_input]: %s can only feed the first command of a pipeline\n", SPLICE_REDIRECT);
+                return COMMAND_PROCESSING_ERROR;
+            }
+            // cmd <| file works like cat file | cmd, except the feeder stage moves the data with splice instead of exec'ing cat
+            // the stage being parsed is not linked in yet, so the feeder becomes the first stage of the pipeline
+            process_t *feeder = create_process(job, 2);
+            feeder->argv[0] = SPLICE_REDIRECT;
+            feeder->argv[1] = buffer + tokens[++ind].offset;
+            feeder->splice_input_filename = feeder->argv[1];
+            *next_process = feeder;
+            next_process = &feeder->next;
+            break;
+        }
+        case TOKEN_PIPE:
+            if ((argc == 0) || (ind + 1 == token_count))
+            {
+                printf("Error [process_input]: %s needs to be placed between two command tokens\n", PIPE);
+                return COMMAND_PROCESSING_ERROR;
+            }
+            // append this process to the end of the job's pipeline
+            *next_process = process;
+            next_process = &process->next;
+
+            // create a new process and reset the argv counter
+            process = create_process(job, count_stage_words(ind + 1, token_count, tokens));
+            argc = 0;
+            break;
+        case TOKEN_BACKGROUND:
+            // check that if found it is the last token - error
+            if ((ind == 0) || ind + 1 < token_count)
+            {
+                printf("Error [process_input]: & cannot be the only command, and can only be placed at the end of a command\n");
+                return COMMAND_PROCESSING_ERROR;
+            }
+            job->background = 1;
+            break;
+        case TOKEN_SEQUENCE:
+        case TOKEN_AND:
+        case TOKEN_OR:
+            // parse_job_line splits lines at these, a job never gets one
+            printf("Error [process_input]: unexpected %s\n", token_type_str(token->type));
+            return COMMAND_PROCESSING_ERROR;
         }
-        dup2(fd, STDIN_FILENO);
-        close(fd);
     }
-    if (process->redirect_output_filename != NULL)
+
+    if (argc == 0)
     {
-        int fd = open(process->redirect_output_filename, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
-        if (fd < 0)
+        printf("Error [process_input]: %s needs to be placed between two command tokens\n", PIPE);
+        return COMMAND_PROCESSING_ERROR;
+    }
+    // the last process is the end of the pipeline
+    *next_process = process;
+    return SUCCESS;
+}
+
+int count_stage_words(int start, int token_count, token_t tokens[])
+{
+    // number of words up to the next pipe, an upper bound on the argv size of that pipeline stage
+    int words = 0;
+    for (int ind = start; ind < token_count && tokens[ind].type != TOKEN_PIPE; ind++)
+    {
+        words += (tokens[ind].type == TOKEN_WORD || tokens[ind].type == TOKEN_INPUT_SUBSTITUTION || tokens[ind].type == TOKEN_OUTPUT_SUBSTITUTION);
+    }
+    return words;
+}
+
+char *add_process_substitution(job_t *job, process_t *process, token_t *token, char *buffer)
+{
+    // <(cmd) and >(cmd): cmd is run by a yash -c child, the stage gets a /dev/fd/N path to its end of a pipe
+    process_t *substitution = create_process(job, 3);
+    substitution->argv[0] = "yash";
+    substitution->argv[1] = COMMAND_STRING_FLAG;
+    substitution->argv[2] = buffer + token->offset;
+    substitution->substitution_type = token->type;
+    substitution->substitution_fd = -1;
+    substitution->helper_fd = -1;
+    substitution->next = process->substitutions;
+    process->substitutions = substitution;
+    // the path is only known once the pipe exists, until then it reads like the source (which also makes it part of a cache key)
+    size_t size = strlen(substitution->argv[2]) + 4;
+    char *path = (char *)arena_alloc(job->arena, (size > SUBSTITUTION_PATH_SIZE) ? size : SUBSTITUTION_PATH_SIZE);
+    sprintf(path, "%s%s)", token_type_str(token->type), substitution->argv[2]);
+    substitution->substitution_path = path;
+    return path;
+}
+
+redirect_t *add_redirect(job_t *job, process_t *process, enum redirect_type type, int fd)
+{
+    // appended, so the redirects are applied in the order they were written
+    redirect_t *redirect = (redirect_t *)arena_alloc(job->arena, sizeof(redirect_t));
+    memset(redirect, 0, sizeof(redirect_t));
+    redirect->type = type;
+    redirect->fd = fd;
+    redirect->source_fd = -1;
+    redirect_t **link = &process->redirects;
+    while (*link != NULL)
+    {
+        link = &(*link)->next;
+    }
+    *link = redirect;
+    return redirect;
+}
+
+int add_redirect_token(job_t *job, process_t *process, token_t *token, char *target)
+{
+    enum redirect_type type = token->redirect_type;
+    int both = token->redirect_both;
+    if (type == REDIRECT_DUPLICATE)
+    {
+        // n>&m and n<&m copy fd m, n>&- closes n
+        if (strcmp(target, CLOSE_FD) == 0 || (target[0] >= '0' && target[0] <= '9' && target[1] == '\0'))
         {
-            status = -1;
-            print_file_redirection_error_str(process->redirect_output_filename);
+            redirect_t *redirect = add_redirect(job, process, REDIRECT_DUPLICATE, token->redirect_fd);
+            redirect->source_fd = (target[0] == CLOSE_FD[0]) ? -1 : target[0] - '0';
+            return SUCCESS;
         }
-        dup2(fd, STDOUT_FILENO);
-        close(fd);
+        if (token->redirect_fd != STDOUT_FILENO || strcmp(token->symbol, DUPLICATE_OUTPUT) != 0)
+        {
+            printf("Error [process_input]: %s%s: bad file descriptor\n", token->symbol, target);
+            return COMMAND_PROCESSING_ERROR;
+        }
+        // like bash, >&file is &>file
+        type = REDIRECT_WRITE;
+        both = 1;
     }
-    if (status == -1)
+    redirect_t *redirect = add_redirect(job, process, type, token->redirect_fd);
+    redirect->filename = target;
+    if (both)
     {
-        nuke_all_file_descriptors();
-        return FILE_REDIRECTION_ERROR;
+        // &>file opens the file once, stderr shares the open file of stdout (so neither overwrites the other)
+        redirect = add_redirect(job, process, REDIRECT_DUPLICATE, STDERR_FILENO);
+        redirect->source_fd = STDOUT_FILENO;
     }
     return SUCCESS;
 }
 
-void nuke_all_file_descriptors()
+int redirects_fd(process_t *process, int fd)
 {
-    // effectively closes all of the standard input, output, and error file descriptors
-    dup2(STDIN_FILENO, STDIN_FILENO);
-    dup2(STDOUT_FILENO, STDIN_FILENO);
-    dup2(STDERR_FILENO, STDIN_FILENO);
+    // whether any redirect of the stage replaces fd
+    for (redirect_t *redirect = process->redirects; redirect != NULL; redirect = redirect->next)
+    {
+        if (redirect->fd == fd)
+        {
+            return 1;
+        }
+    }
+    return 0;
 }
 
-// ==== JOB/PROCESS UPDATE FUNCTIONS ==== //
+// ==== EXPANSION ==== //
 
-int update_job_status(int status, pid_t pid)
+void keep_lexed_words(job_t *job, char *buffer, char *quoting, token_t tokens[], int token_count)
 {
-    // there's one error you may have to account for here, specifically pipes (what exactly is a child process?)
-    // what if a process related to a pipe is stopped or finished but you confuse it for the entire process?
-    // solution now, when we setpgid to pid for both processes - we know if will be put into the list!
-    // [UPDATE] - no, waitpid only waits for direct children :)
+    // the job is still parsed from the unexpanded words, which finds the syntax errors and the here-documents of the line right away
+    int flags = 0;
+    for (int ind = 0; ind < token_count; ind++)
+    {
+        flags |= tokens[ind].expand;
+    }
+    if (flags == 0)
+    {
+        return;
+    }
+    job->lexed_tokens = (token_t *)arena_alloc(job->arena, token_count * sizeof(token_t));
+    memcpy(job->lexed_tokens, tokens, token_count * sizeof(token_t));
+    job->lexed_token_count = token_count;
+    job->lexed_buffer = buffer;
+    job->lexed_quoting = quoting;
+}
 
-    // for unblocking waitpid calls, -1 may be input if there are no processes to update
-    if (pid <= 0)
+job_t *expand_job(job_t *job)
+{
+    // returns the job to run: the job itself, or a new one parsed from its expanded words (the old one is freed), NULL on errors
+    // called right before the job runs, so $? and cd from the jobs before it on the same line are seen
+    if (job->lexed_tokens == NULL)
     {
-        // pid < 0 means an error, and pid == 0 means WNOHANG was provided and child process is not terminated yet
-        return 0;
+        return job;
     }
-    job_t *job = find_job(pid);
-    if (job == NULL)
+    job_t *expanded = create_job(job->command, strlen(job->command));
+    expanded->list_operator = job->list_operator;
+    expanded->list_next = job->list_next;
+    char *buffer = job->lexed_buffer;
+    token_t *tokens = job->lexed_tokens;
+    int token_count = job->lexed_token_count;
+    expand_words(expanded, &buffer, job->lexed_quoting, &tokens, &token_count);
+    TRACE_BEGIN("process_input");
+    int processed = process_input(token_count, tokens, buffer, expanded);
+    TRACE_END("process_input", -1);
+    if (processed == COMMAND_PROCESSING_ERROR)
     {
-        // job NOT found
-        return 1;
+        free_job(expanded);
+        free_job(job);
+        return NULL;
     }
-    if (WIFSTOPPED(status))
+    // set by the callers after parsing (the parallel builtin and server mode)
+    expanded->background |= job->background;
+    // here-documents were read for the old job, delimiters are never expanded so they come in the same order
+    process_t *old_process = job->first_process;
+    redirect_t *old_redirect = (old_process != NULL) ? old_process->redirects : NULL;
+    for (process_t *process = expanded->first_process; process != NULL; process = process->next)
     {
-        // then this process group with pgid was STOPPED
-        // printf("STOPPED\n");
-        job->status = STOPPED;
-        if (WSTOPSIG(status) == SIGTSTP || WSTOPSIG(status) == SIGSTOP)
+        for (redirect_t *redirect = process->redirects; redirect != NULL; redirect = redirect->next)
         {
-            job->background = 1;
-            if (job->job_number == FG_JOB_NUM)
+            if (redirect->delimiter == NULL)
             {
-                // this means we are transitioning a foreground job in to the background
-                // because of foreground jobs blocking stdin, we can be assured there will only ever be one at a given time
-                remove_job(pid, 0);
-                job->job_number = find_most_recent_job_num() + 1;
-                add_job(job);
+                continue;
+            }
+            while (old_process != NULL && (old_redirect == NULL || !old_redirect->from_lines))
+            {
+                if (old_redirect != NULL)
+                {
+                    old_redirect = old_redirect->next;
+                }
+                else if ((old_process = old_process->next) != NULL)
+                {
+                    old_redirect = old_process->redirects;
+                }
+            }
+            if (old_process == NULL)
+            {
+                break;
             }
+            if (old_redirect->text != NULL)
+            {
+                redirect->text = arena_strndup(expanded->arena, old_redirect->text, old_redirect->text_length);
+                redirect->text_length = old_redirect->text_length;
+                redirect->delimiter = NULL;
+            }
+            old_redirect = old_redirect->next;
         }
     }
-    else
-    {
-        // then this process group with pgid terminated ab-or normally, so just mark it as done
-        // if it was terminated via SIGINT, it will not display done because the job was moved to the fg earlier!
-        job->status = DONE;
-    }
-    return 1;
+    free_job(job);
+    return expanded;
 }
 
-void update_job_table_statuses()
+void expand_words(job_t *job, char **buffer, const char *quoting, token_t **tokens, int *token_count)
 {
-    int status;
-    pid_t pid;
-    // poll all child processes of the shell to see if any new processes have finished!
-    do
+    // $NAME, ~ and globs between lexing and building the job, so commands like ls ~/logs/*.log don't need a sh -c
+    // the expanded words are copied into a new buffer in the job's arena, words without any of them are left alone
+    int flags = 0;
+    for (int ind = 0; ind < *token_count; ind++)
+    {
+        flags |= (*tokens)[ind].expand;
+    }
+    if (flags == 0)
+    {
+        return;
+    }
+    word_buffer_t output;
+    memset(&output, 0, sizeof(output));
+    int expanded_count = 0;
+    int expanded_capacity = *token_count;
+    token_t *expanded = (token_t *)malloc(expanded_capacity * sizeof(token_t));
+    for (int ind = 0; ind < *token_count; ind++)
+    {
+        token_t *token = &(*tokens)[ind];
+        enum token_type previous = (ind > 0) ? (*tokens)[ind - 1].type : TOKEN_SEQUENCE;
+        size_t start = output.length;
+        int words = 1;
+        if (token->type == TOKEN_WORD && token->expand != 0 && previous != TOKEN_HERE_DOCUMENT)
+        {
+            // redirect targets and here-strings stay one word, and aren't globbed
+            int single = (previous == TOKEN_REDIRECT || previous == TOKEN_SPLICE_REDIRECT || previous == TOKEN_HERE_STRING);
+            words = expand_word(*buffer + token->offset, quoting + token->offset, token->length, single ? token->expand & ~EXPAND_GLOB : token->expand,
+                                !single, &output);
+            if (single && words != 1)
+            {
+                // an unquoted expansion that came out empty, the redirect still needs its (empty) word
+                append_word_text(&output, "", 1, 0);
+                words = 1;
+            }
+        }
+        else if (token->type == TOKEN_WORD || token->type == TOKEN_INPUT_SUBSTITUTION || token->type == TOKEN_OUTPUT_SUBSTITUTION)
+        {
+            append_word_text(&output, *buffer + token->offset, token->length, 0);
+            append_word_text(&output, "", 1, 0);
+        }
+        for (int word = 0; word < words; word++)
+        {
+            if (expanded_count == expanded_capacity)
+            {
+                expanded_capacity *= 2;
+                expanded = (token_t *)realloc(expanded, expanded_capacity * sizeof(token_t));
+            }
+            token_t *result = &expanded[expanded_count++];
+            *result = *token;
+            result->offset = start;
+            result->length = (token->type == TOKEN_WORD || words != 1 || start < output.length) ? strlen(output.text + start) : 0;
+            // whatever a word expanded to is never taken for a keyword
+            result->quoted |= (token->expand != 0);
+            start += result->length + 1;
+        }
+    }
+    int has_word = 0;
+    for (int ind = 0; ind < expanded_count; ind++)
+    {
+        // redirect targets don't count, those need a command in front of them
+        enum token_type previous = (ind > 0) ? expanded[ind - 1].type : TOKEN_SEQUENCE;
+        has_word |= (expanded[ind].type == TOKEN_WORD && previous != TOKEN_REDIRECT && previous != TOKEN_SPLICE_REDIRECT &&
+                     previous != TOKEN_HERE_STRING && previous != TOKEN_HERE_DOCUMENT);
+    }
+    if (!has_word)
+    {
+        // every word expanded to nothing, sh then runs an empty command that succeeds (redirects still happen)
+        expanded = (token_t *)realloc(expanded, (expanded_count + 1) * sizeof(token_t));
+        memmove(expanded + 1, expanded, expanded_count * sizeof(token_t));
+        memset(expanded, 0, sizeof(token_t));
+        expanded[0].type = TOKEN_WORD;
+        expanded[0].offset = output.length;
+        expanded[0].length = strlen(TRUE_COMMAND);
+        expanded[0].quoted = 1;
+        append_word_text(&output, TRUE_COMMAND, expanded[0].length + 1, 0);
+        expanded_count++;
+    }
+    // a part whose words all expanded to nothing has neither text nor tokens left
+    *buffer = (char *)arena_alloc(job->arena, output.length + 1);
+    if (output.length > 0)
+    {
+        memcpy(*buffer, output.text, output.length);
+    }
+    (*buffer)[output.length] = '\0';
+    *tokens = (token_t *)arena_alloc(job->arena, expanded_count * sizeof(token_t));
+    if (expanded_count > 0)
     {
-        pid = waitpid(-1, &status, WNOHANG | WUNTRACED);
-    } while (update_job_status(status, pid));
+        memcpy(*tokens, expanded, expanded_count * sizeof(token_t));
+    }
+    *token_count = expanded_count;
+    free(expanded);
+    free(output.text);
+    free(output.pattern);
 }
 
-void update_job_command_str(job_t *job, int apply_bg)
+int expand_word(const char *word, const char *quoting, size_t length, int flags, int split, word_buffer_t *output)
 {
-    int len = strlen(job->command);
-    if (apply_bg)
+    // appends the NUL terminated words this word expands to, and returns how many there are
+    // unquoted expansions are split at FIELD_SEPARATORS (and then not globbed, unlike sh), one that expands to nothing leaves no word
+    word_buffer_t field;
+    memset(&field, 0, sizeof(field));
+    int field_exists = 0;
+    int words = 0;
+    size_t i = 0;
+    char number[32];
+    if ((flags & EXPAND_TILDE) && length > 0 && word[0] == '~' && quoting[0] == CHAR_UNQUOTED)
     {
-        if (job->command[len - 1] == '&' && job->command[len - 2] == ' ')
+        // ~ and ~user, up to the first slash
+        size_t end = 1;
+        while (end < length && word[end] != '/' && quoting[end] == CHAR_UNQUOTED)
         {
-            // suffix already included, no update required
-            return;
+            end++;
+        }
+        const char *home = (end == length || word[end] == '/') ? tilde_directory(word + 1, end - 1) : NULL;
+        if (home != NULL)
+        {
+            append_word_text(&field, home, strlen(home), 0);
+            field_exists = 1;
+            i = end;
         }
-        char bg_suffix[2] = " &";
-        char *updated_command = (char *)malloc((len + 3) * sizeof(char));
-        memset(updated_command, '\0', (len + 3) * sizeof(char));
-        strcat(updated_command, job->command);
-        strcat(updated_command, bg_suffix);
-        free(job->command);
-        job->command = updated_command;
     }
-    else
+    for (; i < length; i++)
     {
-        // we're updating a string from the bg to the fg
-        if (!(job->command[len - 1] == '&' && job->command[len - 2] == ' '))
+        if (word[i] == '$' && quoting[i] != CHAR_LITERAL && (flags & EXPAND_VARIABLES))
         {
-            // suffix not present, no need for removal
-            return;
-        }
-        // remove the background job suffix via null termination!
-        job->command[len - 1] = '\0';
+            size_t consumed;
+            const char *value = lookup_variable(word + i + 1, quoting + i + 1, quoting[i], length - i - 1, &consumed, number);
+            if (value != NULL)
+            {
+                i += consumed;
+                if (quoting[i - consumed] != CHAR_UNQUOTED || !split)
+                {
+                    append_word_text(&field, value, strlen(value), 0);
+                    field_exists = 1;
+                    continue;
+                }
+                for (const char *c = value; *c != '\0'; c++)
+                {
+                    if (strchr(FIELD_SEPARATORS, *c) == NULL)
+                    {
+                        append_word_text(&field, c, 1, 0);
+                        field_exists = 1;
+                    }
+                    else if (field_exists)
+                    {
+                        words += end_expanded_word(&field, output);
+                        field_exists = 0;
+                    }
+                }
+                continue;
+            }
+        }
+        append_word_text(&field, word + i, 1, (flags & EXPAND_GLOB) && quoting[i] == CHAR_UNQUOTED && strchr(GLOB_CHARS, word[i]) != NULL);
+        field_exists = 1;
+    }
+    if (field_exists)
+    {
+        words += end_expanded_word(&field, output);
+    }
+    free(field.text);
+    free(field.pattern);
+    return words;
+}
+
+const char *lookup_variable(const char *text, const char *quoting, char quote, size_t length, size_t *consumed, char number[])
+{
+    // $NAME, ${NAME}, $? and $$ (the name quoted like its $), NULL leaves the $ as it is
+    // the shell's variables are its environment, export and unset change them
+    if (length == 0 || quoting[0] != quote)
+    {
+        return NULL;
+    }
+    if (text[0] == '?' || text[0] == '$')
+    {
+        snprintf(number, 32, "%d", (text[0] == '?') ? last_exit_status : shell_pid);
+        *consumed = 1;
+        return number;
+    }
+    size_t start = (text[0] == '{');
+    size_t end = start;
+    while (end < length && quoting[end] == quote && (isalnum((unsigned char)text[end]) || text[end] == '_') &&
+           !(end == start && isdigit((unsigned char)text[end])))
+    {
+        end++;
+    }
+    if (end == start || end - start >= VARIABLE_NAME_MAX || (start == 1 && (end == length || text[end] != '}' || quoting[end] != quote)))
+    {
+        return NULL;
+    }
+    char name[VARIABLE_NAME_MAX];
+    memcpy(name, text + start, end - start);
+    name[end - start] = '\0';
+    *consumed = end + start;
+    const char *value = getenv(name);
+    return (value != NULL) ? value : "";
+}
+
+const char *tilde_directory(const char *user, size_t length)
+{
+    if (length == 0)
+    {
+        const char *home = getenv("HOME");
+        if (home != NULL)
+        {
+            return home;
+        }
+        struct passwd *entry = getpwuid(getuid());
+        return (entry != NULL) ? entry->pw_dir : NULL;
+    }
+    char name[VARIABLE_NAME_MAX];
+    if (length >= sizeof(name))
+    {
+        return NULL;
+    }
+    memcpy(name, user, length);
+    name[length] = '\0';
+    struct passwd *entry = getpwnam(name);
+    return (entry != NULL) ? entry->pw_dir : NULL;
+}
+
+int end_expanded_word(word_buffer_t *field, word_buffer_t *output)
+{
+    // the finished word goes to the output as it is, or as the paths its pattern matches
+    int words = 0;
+    if (memchr(field->pattern, 1, field->length) != NULL)
+    {
+        word_buffer_t path;
+        memset(&path, 0, sizeof(path));
+        words = expand_glob(field, 0, &path, 0, output);
+        free(path.text);
+        free(path.pattern);
+    }
+    if (words == 0)
+    {
+        // like sh, a pattern without matches stays as it is
+        append_word_text(output, field->text, field->length, 0);
+        append_word_text(output, "", 1, 0);
+        words = 1;
+    }
+    field->length = 0;
+    return words;
+}
+
+int expand_glob(word_buffer_t *field, size_t position, word_buffer_t *path, int check, word_buffer_t *output)
+{
+    // matches the rest of the pattern from position on below path, one path component at a time
+    // directories come from the completion cache, read once and sorted, so the matches come out sorted without another qsort
+    // check is set after a literal component, which only exists if the final path does
+    while (position < field->length && field->text[position] == '/')
+    {
+        append_word_text(path, "/", 1, 0);
+        position++;
+    }
+    if (position == field->length)
+    {
+        struct stat path_stat;
+        if (check && lstat(path->text, &path_stat) < 0)
+        {
+            return 0;
+        }
+        append_word_text(output, path->text, path->length, 0);
+        append_word_text(output, "", 1, 0);
+        return 1;
+    }
+    size_t end = position;
+    int has_pattern = 0;
+    while (end < field->length && field->text[end] != '/')
+    {
+        has_pattern |= field->pattern[end++];
+    }
+    size_t path_length = path->length;
+    int words = 0;
+    if (!has_pattern)
+    {
+        append_word_text(path, field->text + position, end - position, 0);
+        words = expand_glob(field, end, path, 1, output);
+        path->length = path_length;
+        return words;
+    }
+    // fnmatch gets the component with everything quoted escaped, the part before the first pattern character narrows the scan
+    char *pattern = (char *)malloc(2 * (end - position) + 1);
+    size_t pattern_length = 0;
+    size_t prefix_length = 0;
+    int in_prefix = 1;
+    for (size_t i = position; i < end; i++)
+    {
+        in_prefix &= !field->pattern[i];
+        prefix_length += in_prefix;
+        if (!field->pattern[i] && strchr(GLOB_CHARS "\\", field->text[i]) != NULL)
+        {
+            pattern[pattern_length++] = '\\';
+        }
+        pattern[pattern_length++] = field->text[i];
+    }
+    pattern[pattern_length] = '\0';
+    append_word_text(path, "", 1, 0);
+    directory_listing_t *listing = get_directory_listing(path_length == 0 ? "." : path->text);
+    path->length = path_length;
+    // the listing may be evicted from the cache by the deeper levels, so the matching names are copied first
+    word_buffer_t names;
+    memset(&names, 0, sizeof(names));
+    for (int i = (listing != NULL) ? directory_lower_bound(listing, field->text + position, prefix_length) : 0; listing != NULL && i < listing->count; i++)
+    {
+        directory_entry_t *entry = &listing->entries[i];
+        if (strncmp(entry->name, field->text + position, prefix_length) != 0)
+        {
+            break;
+        }
+        // FNM_PERIOD: hidden files only match a pattern that starts with a dot
+        if ((end == field->length || entry->is_dir) && fnmatch(pattern, entry->name, FNM_PERIOD) == 0)
+        {
+            append_word_text(&names, entry->name, strlen(entry->name) + 1, 0);
+        }
+    }
+    free(pattern);
+    for (size_t offset = 0; offset < names.length; offset += strlen(names.text + offset) + 1)
+    {
+        append_word_text(path, names.text + offset, strlen(names.text + offset), 0);
+        words += expand_glob(field, end, path, 0, output);
+        path->length = path_length;
+    }
+    free(names.text);
+    free(names.pattern);
+    return words;
+}
+
+void append_word_text(word_buffer_t *buffer, const char *text, size_t length, int pattern)
+{
+    // always keeps a NUL after the text, so a path being built can be used as a string right away
+    if (buffer->length + length + 1 > buffer->capacity)
+    {
+        size_t capacity = (buffer->capacity == 0) ? WORD_BUFFER_INITIAL_CAPACITY : buffer->capacity;
+        while (buffer->length + length + 1 > capacity)
+        {
+            capacity *= 2;
+        }
+        buffer->text = (char *)realloc(buffer->text, capacity);
+        buffer->pattern = (char *)realloc(buffer->pattern, capacity);
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->text + buffer->length, text, length);
+    memset(buffer->pattern + buffer->length, pattern, length);
+    buffer->length += length;
+    buffer->text[buffer->length] = '\0';
+}
+
+// ==== PROCESS LAUNCHING ==== //
+void execute_job(job_t *job)
+{
+    int pgid = -1;
+    // children write straight to the fds, so anything the shell printed has to go out first
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &job->start_time);
+    session_jobs_run++;
+    if (job->background)
+    {
+        job->job_number = find_most_recent_job_num() + 1;
+    }
+    else
+    {
+        job->job_number = FG_JOB_NUM;
+    }
+    job->capture_fd = -1;
+    if (job->background)
+    {
+        start_output_capture(job);
+    }
+    if (job->cache != NULL && replay_cached_result(job))
+    {
+        // served from the result cache, nothing to run
+        if (job->timed)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &job->end_time);
+            print_job_times(job);
+        }
+        free_job(job);
+        return;
+    }
+    job->cgroup_fd = -1;
+    job->cgroup_procs_fd = -1;
+    open_job_cgroup(job);
+    open_process_substitutions(job);
+    // check if you need to launch a piped process or a single process
+    if (job->first_process->next != NULL)
+    {
+        pgid = execute_pipe_process(job);
+    }
+    else
+    {
+        pgid = execute_process(job);
+    }
+    start_process_substitutions(job, pgid);
+    if (job->capture_fd >= 0)
+    {
+        // only the children write into the capture pipe
+        close(job->capture_fd);
+        job->capture_fd = -1;
+    }
+    if (job->cache != NULL)
+    {
+        close(job->cache->write_fd);
+        job->cache->write_fd = -1;
+    }
+
+    // update controlling job
+    job->pgid = pgid;
+    job->status = RUNNING;
+
+    add_job(job);
+    if (job->server_client != NULL)
+    {
+        job->server_client->jobs_running++;
+        send_job_reply(job, "started");
+    }
+
+    // delegate job to being registered in the foreground or background
+    if (!job->background)
+    {
+        execute_in_foreground(job);
+    }
+    // else we continue on with execution, given that the process is now successfully running in the background
+}
+
+void execute_job_list(job_t *job)
+{
+    // the jobs of one command line back to back, && and || decide on the exit status the previous job left behind
+    while (job != NULL)
+    {
+        job_t *next = job->list_next;
+        job->list_next = NULL;
+        int run = (job->list_operator == TOKEN_AND)  ? (last_exit_status == EXIT_SUCCESS)
+                  : (job->list_operator == TOKEN_OR) ? (last_exit_status != EXIT_SUCCESS)
+                                                     : 1;
+        if (!run)
+        {
+            // skipped, the status stays for the operator after it (a || b && c runs c when a succeeds)
+            free_job(job);
+        }
+        else if ((job = expand_job(job)) == NULL)
+        {
+            // the expanded words didn't make a command, like a syntax error the job doesn't run
+            last_exit_status = EXIT_FAILURE;
+        }
+        else if (execute_custom_commands(job))
+        {
+            free_job(job);
+        }
+        else
+        {
+            execute_job(job);
+        }
+        job = next;
+    }
+}
+
+int execute_process(job_t *job)
+{
+    // passing a pgid of 0 makes the child the leader of its own process group
+    int pid = spawn_process(job, job->first_process, 0, STDIN_FILENO, job_output_fd(job));
+    if (pid < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    job->first_process->pid = pid;
+    return pid;
+}
+
+int execute_pipe_process(job_t *job)
+{
+    // every stage is a direct child of the shell, the first stage becomes the leader of the job's process group
+    pid_t pgid = 0;
+    int input_fd = STDIN_FILENO;
+    int pipe_fd[2];
+    process_t *process = job->first_process;
+    while (process != NULL)
+    {
+        // the last stage writes to the terminal, or into the capture or cache pipe
+        int output_fd = job_output_fd(job);
+        if (process->next != NULL)
+        {
+            // create fd for pipe, close-on-exec so each child only keeps the ends it dup2's onto stdin/stdout
+            int pipe_creation_status = pipe2(pipe_fd, O_CLOEXEC);
+            if (pipe_creation_status < 0)
+            {
+                exit(EXIT_FAILURE);
+            }
+            output_fd = pipe_fd[1];
+            set_pipe_size(output_fd);
+        }
+        pid_t pid = spawn_process(job, process, pgid, input_fd, output_fd);
+        if (pid < 0)
+        {
+            exit(EXIT_FAILURE);
+        }
+        process->pid = pid;
+        if (pgid == 0)
+        {
+            pgid = pid;
+        }
+        // the children hold their own copies of the pipe ends now
+        if (input_fd != STDIN_FILENO)
+        {
+            close(input_fd);
+        }
+        if (output_fd != STDOUT_FILENO && output_fd != job_output_fd(job))
+        {
+            close(output_fd);
+        }
+        input_fd = pipe_fd[0];
+        process = process->next;
+    }
+    return pgid;
+}
+
+pid_t spawn_process(job_t *job, process_t *process, pid_t pgid, int input_fd, int output_fd)
+{
+    pid_t pid = -1;
+    int cloned = 0;
+    int pidfd = -1;
+    // a builtin that isn't the whole job runs in a copy of the shell, like bash's subshells (see exec_child)
+    process->builtin = (process->splice_input_filename == NULL && process->substitution_type == TOKEN_WORD) ? find_builtin(process->argv[0]) : NULL;
+    // resolve the command in the shell once, instead of every child walking PATH with failed execve's
+    process->exec_path = (process->splice_input_filename == NULL && process->builtin == NULL) ? resolve_command(process->argv[0]) : NULL;
+    if (process->substitution_type != TOKEN_WORD)
+    {
+        process->exec_path = SELF_EXE_PATH;
+    }
+    process->exec_errno = 0;
+    // with vfork the span also covers the child's setup up to its execve
+    TRACE_BEGIN("spawn");
+    if (job->cgroup_fd >= 0 && !clone3_unavailable)
+    {
+        // the child starts out inside the job's cgroup, nothing it does escapes the limits or the accounting
+        pid = clone_into_cgroup(job, &pidfd);
+        cloned = (pid >= 0);
+    }
+    process->cloned_into_cgroup = cloned;
+    // a splice feeder or a builtin keeps running in the child, so it can't borrow the shell's memory (the shell would wait for it)
+    if (!cloned && spawn_mode == SPAWN_MODE_VFORK && process->splice_input_filename == NULL && process->builtin == NULL)
+    {
+        // vfork borrows the shell's address space until the child execs, so no page tables get copied
+        // the shell is suspended until then, so the child must only exec or _exit (see exec_child)
+        int shell_errno = errno;
+        pid = vfork();
+        if (pid > 0)
+        {
+            // errno is the same memory in the child, whatever its failed calls left there isn't the shell's
+            errno = shell_errno;
+        }
+    }
+    if (pid < 0)
+    {
+        // fork is kept as the fallback when vfork is disabled or unavailable
+        pid = fork();
+    }
+    if (pid < 0)
+    {
+        TRACE_END("spawn", -1);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        exec_child(job, process, pgid, input_fd, output_fd);
+    }
+    TRACE_END("spawn", pid);
+    if (process->exec_errno == ENOENT && process->exec_path != process->argv[0])
+    {
+        // a vfork child found the cached path gone, so it fell back to a PATH search (only visible through vfork's shared memory)
+        command_cache_forget(process->argv[0]);
+    }
+    // also set the pgid from the shell side: with fork the shell may use the pgid before the child has set it
+    // (fails harmlessly once the child has already exec'd)
+    if (interactive)
+    {
+        setpgid(pid, (pgid == 0) ? pid : pgid);
+    }
+    process->pid = pid;
+    track_process(process, pidfd);
+    return pid;
+}
+
+void exec_child(job_t *job, process_t *process, pid_t pgid, int input_fd, int output_fd)
+{
+    // NOTE: this may run in a vfork child sharing memory with the shell - no malloc, no exit(), no touching shell state
+    // (only async-signal-safe calls, spawn_process puts back the errno they leave behind)
+    // without job control every child stays in the shell's process group and never touches the terminal
+    if (interactive)
+    {
+        setpgid(0, pgid);
+    }
+
+    // check if you need to launch in the foreground or the background
+    if (interactive && !job->background)
+    {
+        // SIGTTOU is still ignored (inherited from the shell), so the child can grab the terminal from the background
+        // have to use our own pgid since job->pgid may not be set yet due to race conditions
+        tcsetpgrp(STDIN_FILENO, (pgid == 0) ? getpid() : pgid);
+    }
+
+    // signal stuff, through sigaction with a struct on the child's own stack (signal() is not async-signal-safe)
+    // the dispositions are the child's even with vfork, only default and ignore are set so no handler runs in borrowed memory
+    struct sigaction child_action;
+    memset(&child_action, 0, sizeof(child_action));
+    child_action.sa_handler = SIG_DFL;
+    sigaction(SIGINT, &child_action, NULL);
+    sigaction(SIGTSTP, &child_action, NULL);
+    sigaction(SIGTTOU, &child_action, NULL);
+    sigaction(SIGTTIN, &child_action, NULL);
+    if (!interactive && job->background)
+    {
+        // background jobs of a non job control shell share its process group, so keep keyboard interrupts away from them
+        child_action.sa_handler = SIG_IGN;
+        sigaction(SIGINT, &child_action, NULL);
+        sigaction(SIGQUIT, &child_action, NULL);
+    }
+    if (job->cgroup_procs_fd >= 0 && !process->cloned_into_cgroup)
+    {
+        // without clone3 the child moves itself into the job's cgroup before it execs
+        // one that can't get in would run outside the job's limits, so it fails like a bad redirect instead
+        if (write(job->cgroup_procs_fd, "0", 1) != 1)
+        {
+            write_error_message(job->cgroup_path, errno);
+            _exit(EXIT_FAILURE);
+        }
+    }
+    // the shell blocks SIGCHLD for its signalfd, and the mask survives exec
+    sigset_t empty_mask;
+    sigemptyset(&empty_mask);
+    sigprocmask(SIG_SETMASK, &empty_mask, NULL);
+
+    // apply pipe redirection (the original pipe fds are close-on-exec)
+    if (job->capture_fd >= 0)
+    {
+        // every stage of a captured job reports its errors into the ring too, an explicit 2> still wins below
+        dup2(job->capture_fd, STDERR_FILENO);
+    }
+    if (input_fd != STDIN_FILENO)
+    {
+        dup2(input_fd, STDIN_FILENO);
+    }
+    if (output_fd != STDOUT_FILENO)
+    {
+        dup2(output_fd, STDOUT_FILENO);
+    }
+
+    for (process_t *substitution = process->substitutions; substitution != NULL; substitution = substitution->next)
+    {
+        // the only pipe end this stage keeps across exec
+        fcntl(substitution->substitution_fd, F_SETFD, 0);
+    }
+    int redirects_status = apply_file_redirects(process);
+    if (redirects_status == FILE_REDIRECTION_ERROR)
+    {
+        // terminate the program if any file redirections encountered
+        _exit(EXIT_FAILURE);
+    }
+    if (process->builtin != NULL)
+    {
+        // always a fork child, see spawn_process
+        // the builtin works on the child's copy of the shell, an exit in there is the child's, not the shell's
+        server_fd = -1;
+        session_summary = 0;
+        exit(process->builtin->handler(process->argv));
+    }
+    if (process->splice_input_filename != NULL)
+    {
+        // always a fork child, see spawn_process
+        // it never execs, so drop the inherited close-on-exec pipe ends (holding its own read end would hide a closed reader)
+        close_range(STDERR_FILENO + 1, ~0U, 0);
+        _exit(splice_file_to_stdout(process->splice_input_filename));
+    }
+    // means we're good to exec
+    if (process->exec_path == NULL)
+    {
+        // not found anywhere in PATH
+        _exit(EXIT_FAILURE);
+    }
+    execve(process->exec_path, process->argv, environ);
+    process->exec_errno = errno;
+    if (errno == ENOENT && process->exec_path != process->argv[0])
+    {
+        // the cached path went stale
+        execvp(process->argv[0], process->argv);
+    }
+    _exit(EXIT_FAILURE);
+}
+
+int splice_file_to_stdout(const char *filename)
+{
+    // the feeder of <|, stdout is the pipe to the next stage
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        print_file_redirection_error_str((char *)filename);
+        return EXIT_FAILURE;
+    }
+    ssize_t moved;
+    // splice moves page references from the page cache into the pipe without copying through user space
+    while ((moved = splice(fd, NULL, STDOUT_FILENO, NULL, SPLICE_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0)
+    {
+    }
+    if (moved < 0 && (errno == EINVAL || errno == ENOSYS))
+    {
+        // not every file system or stdout supports splice, fall back to copying
+        char buffer[SCRIPT_READ_CHUNK];
+        ssize_t count;
+        moved = 0;
+        while (moved >= 0 && (count = read(fd, buffer, sizeof(buffer))) > 0)
+        {
+            for (ssize_t written = 0; written < count; written += moved)
+            {
+                moved = write(STDOUT_FILENO, buffer + written, count - written);
+                if (moved < 0)
+                {
+                    break;
+                }
+            }
+        }
+    }
+    close(fd);
+    return (moved < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+void set_pipe_size(int fd)
+{
+    // YASH_PIPE_SIZE (bytes) grows pipe buffers past the kernel's 64 KiB default, fewer context switches for high volume pipelines
+    // read per pipeline so export can change it, an unprivileged shell can't go past /proc/sys/fs/pipe-max-size and keeps the default then
+    char *requested_size = getenv(PIPE_SIZE_ENV);
+    if (requested_size == NULL)
+    {
+        return;
+    }
+    int size = atoi(requested_size);
+    if (size > 0)
+    {
+        fcntl(fd, F_SETPIPE_SZ, size);
+    }
+}
+
+void execute_in_foreground(job_t *job)
+{
+    int status;
+    pid_t pid;
+
+    // have to set this due to race conditions (the shell may reach foreground execution before the child has the chance to tcsetgrp)
+    if (interactive)
+    {
+        TRACE_BEGIN("tcsetpgrp");
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+        TRACE_END("tcsetpgrp", job->pgid);
+    }
+    // from here on the time is the children's, up to the reap of the last stage
+    TRACE_BEGIN("wait");
+    struct rusage usage;
+    if ((active_output_rings > 0 || job->cache != NULL) && event_fd >= 0)
+    {
+        // captured background jobs (and the output of a cached job) must keep being drained, or they block on a full pipe
+        wait_in_foreground_capturing(job);
+    }
+    else
+    {
+        do
+        {
+            pid = wait4(-1, &status, WUNTRACED, &usage);
+        } while (update_job_status(status, pid, &usage) && (job->status == RUNNING));
+    }
+    TRACE_END("wait", job->pgid);
+    if (interactive)
+    {
+        TRACE_BEGIN("tcsetpgrp");
+        tcsetpgrp(STDIN_FILENO, shell_pid);
+        TRACE_END("tcsetpgrp", shell_pid);
+    }
+    // stopped jobs report 128 + SIGTSTP like bash
+    last_exit_status = (job->status == DONE) ? job->exit_code : 128 + SIGTSTP;
+    if (job->cache != NULL && job->status == DONE)
+    {
+        finish_cached_result(job);
+    }
+    if (job->timed && job->status == DONE)
+    {
+        // reported right away, the rest of the command line may still be running when the job is cleaned up
+        print_job_times(job);
+        job->timed = 0;
+    }
+}
+
+void continue_background_job(job_t *job, int fg)
+{
+    // make sure to turn off notifications for this job when it finishes in foreground!
+    // by default foreground jobs will not start off with the notification flag
+    int kill_signal_sent_status = signal_job(job, SIGCONT);
+    if (kill_signal_sent_status < 0)
+    {
+        job->status = STOPPED;
+        note_stopped_job(job);
+        return;
+    }
+    for (process_t *process = job->first_process; process != NULL; process = process->next)
+    {
+        process->stopped = 0;
+    }
+    if (fg)
+    {
+        execute_in_foreground(job);
+    }
+    // else we continue on with execution, given that the process is now successfully running in the background
+}
+
+int signal_job(job_t *job, int sig)
+{
+    if (interactive)
+    {
+        // the whole pipeline shares one process group, which also reaches whatever the stages started themselves
+        // the pgid can't be recycled while any stage is unreaped, and a job with every stage reaped is done
+        return kill(-job->pgid, sig);
+    }
+    // without job control the stages live in the shell's own process group, so signal them one by one
+    // through their pidfds, which can't hit an unrelated process that got a recycled pid
+    int status = 0;
+    for (process_t *process = job->first_process; process != NULL; process = process->next)
+    {
+        if (process->completed)
+        {
+            continue;
+        }
+        int result = (process->pidfd >= 0) ? syscall(SYS_pidfd_send_signal, process->pidfd, sig, NULL, 0) : kill(process->pid, sig);
+        if (result < 0)
+        {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+void print_file_redirection_error_str(char *filename)
+{
+    write_error_message(filename, errno);
+}
+
+void write_error_message(const char *subject, int error)
+{
+    // one write(2) from a stack buffer, this runs in (possibly vfork'd) children where malloc and the parent's stdio buffers are off limits
+    // the child _exits after it, the shell itself only gets here for the redirects of a builtin
+    char message[FILENAME_MAX + 128];
+    int length = snprintf(message, sizeof(message), "-yash: %s: %s\n", subject, strerror(error));
+    if (length > (int)sizeof(message) - 1)
+    {
+        length = sizeof(message) - 1;
+        message[length - 1] = '\n';
+    }
+    if (length > 0)
+    {
+        // a failed write has nowhere left to be reported
+        ssize_t written = write(STDERR_FILENO, message, length);
+        (void)written;
+    }
+}
+
+int apply_file_redirects(process_t *process)
+{
+    // one pass over the redirect list, every file is opened once (close-on-exec until it is dup2'd into place)
+    // NOTE: may run in a vfork child, so only system calls and error messages here
+    for (redirect_t *redirect = process->redirects; redirect != NULL; redirect = redirect->next)
+    {
+        int fd;
+        switch (redirect->type)
+        {
+        case REDIRECT_READ:
+            fd = open(redirect->filename, O_RDONLY | O_CLOEXEC);
+            break;
+        case REDIRECT_WRITE:
+            fd = open(redirect->filename, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+            break;
+        case REDIRECT_APPEND:
+            fd = open(redirect->filename, O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+            break;
+        case REDIRECT_HERE_DOCUMENT:
+            fd = open_here_document(redirect->text, redirect->text_length);
+            break;
+        default:
+            // dup2 never copies close-on-exec, so the new fd survives exec
+            if (redirect->source_fd < 0)
+            {
+                close(redirect->fd);
+            }
+            else if (redirect->source_fd != redirect->fd && dup2(redirect->source_fd, redirect->fd) < 0)
+            {
+                int error = errno;
+                char source[16];
+                snprintf(source, sizeof(source), "%d", redirect->source_fd);
+                write_error_message(source, error);
+                nuke_all_file_descriptors();
+                return FILE_REDIRECTION_ERROR;
+            }
+            continue;
+        }
+        if (fd < 0)
+        {
+            // like sh, the first redirect that fails stops the command
+            if (redirect->type == REDIRECT_HERE_DOCUMENT)
+            {
+                write_error_message("here document", errno);
+            }
+            else
+            {
+                print_file_redirection_error_str(redirect->filename);
+            }
+            nuke_all_file_descriptors();
+            return FILE_REDIRECTION_ERROR;
+        }
+        if (fd == redirect->fd)
+        {
+            // open reused the (closed) target itself, it only has to stay open across exec
+            fcntl(fd, F_SETFD, 0);
+            continue;
+        }
+        dup2(fd, redirect->fd);
+        close(fd);
+    }
+    return SUCCESS;
+}
+
+int open_here_document(const char *text, size_t length)
+{
+    // an anonymous memory file holding the text, read from the start like a real file but never on disk
+    // NOTE: may run in a vfork child, so only system calls here
+    int fd = memfd_create("yash-here-document", MFD_CLOEXEC);
+    if (fd < 0)
+    {
+        // without memfd a pipe does as long as the text fits into it, nobody else could write the rest
+        int pipe_fd[2];
+        if (pipe2(pipe_fd, O_CLOEXEC) < 0 || (size_t)fcntl(pipe_fd[1], F_GETPIPE_SZ) < length)
+        {
+            return -1;
+        }
+        fd = pipe_fd[0];
+        if (write(pipe_fd[1], text, length) != (ssize_t)length)
+        {
+            close(fd);
+            fd = -1;
+        }
+        close(pipe_fd[1]);
+        return fd;
+    }
+    for (size_t written = 0; written < length;)
+    {
+        ssize_t count = write(fd, text + written, length - written);
+        if (count < 0 && errno != EINTR)
+        {
+            close(fd);
+            return -1;
+        }
+        written += (count > 0) ? count : 0;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+void open_process_substitutions(job_t *job)
+{
+    // one pipe per substitution, created before the stages so each stage can be handed its /dev/fd/N
+    for (process_t *process = job->first_process; process != NULL; process = process->next)
+    {
+        for (process_t *substitution = process->substitutions; substitution != NULL; substitution = substitution->next)
+        {
+            int pipe_fd[2];
+            if (pipe2(pipe_fd, O_CLOEXEC) < 0)
+            {
+                perror("-yash: process substitution");
+                continue;
+            }
+            // <(cmd): the stage reads what cmd writes, >(cmd): cmd reads what the stage writes
+            int stage_end = (substitution->substitution_type == TOKEN_INPUT_SUBSTITUTION) ? 0 : 1;
+            substitution->substitution_fd = pipe_fd[stage_end];
+            substitution->helper_fd = pipe_fd[1 - stage_end];
+            sprintf(substitution->substitution_path, "/dev/fd/%d", substitution->substitution_fd);
+        }
+    }
+}
+
+void start_process_substitutions(job_t *job, pid_t pgid)
+{
+    // the commands join the job's process group, so ^C and ^Z reach them too
+    // they are not tracked as stages, like in bash the job is done when its stages are (the shell still reaps them)
+    for (process_t *process = job->first_process; process != NULL; process = process->next)
+    {
+        for (process_t *substitution = process->substitutions; substitution != NULL; substitution = substitution->next)
+        {
+            if (substitution->helper_fd < 0)
+            {
+                continue;
+            }
+            int input = (substitution->substitution_type == TOKEN_OUTPUT_SUBSTITUTION) ? substitution->helper_fd : STDIN_FILENO;
+            int output = (substitution->substitution_type == TOKEN_INPUT_SUBSTITUTION) ? substitution->helper_fd : STDOUT_FILENO;
+            substitution->pid = spawn_process(job, substitution, (pgid > 0) ? pgid : 0, input, output);
+            close(substitution->helper_fd);
+            close(substitution->substitution_fd);
+            substitution->helper_fd = -1;
+            substitution->substitution_fd = -1;
+        }
+    }
+}
+
+void nuke_all_file_descriptors()
+{
+    // effectively closes all of the standard input, output, and error file descriptors
+    dup2(STDIN_FILENO, STDIN_FILENO);
+    dup2(STDOUT_FILENO, STDIN_FILENO);
+    dup2(STDERR_FILENO, STDIN_FILENO);
+}
+
+// ==== JOB/PROCESS UPDATE FUNCTIONS ==== //
+
+int update_job_status(int status, pid_t pid, struct rusage *usage)
+{
+    // every pipeline stage is a direct child of the shell, so pid is the pid of one stage of a job
+    // a job is only stopped or done once all of its stages are
+
+    // for unblocking waitpid calls, -1 may be input if there are no processes to update
+    if (pid <= 0)
+    {
+        // pid < 0 means an error, and pid == 0 means WNOHANG was provided and child process is not terminated yet
+        return 0;
+    }
+    process_t *process;
+    job_t *job = find_process_job(pid, &process);
+    if (job == NULL)
+    {
+        // job NOT found
+        return 1;
+    }
+    process->status = status;
+    TRACE_INSTANT(WIFSTOPPED(status) ? "stop" : "reap", pid, status);
+    if (WIFSTOPPED(status))
+    {
+        process->stopped = 1;
+    }
+    else
+    {
+        process->completed = 1;
+        release_process_pidfd(process);
+        process->usage = *usage;
+        process->exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        clock_gettime(CLOCK_MONOTONIC, &process->end_time);
+    }
+
+    if (job_is_completed(job))
+    {
+        // then every process in this process group terminated ab-or normally, so just mark it as done
+        // if it was terminated via SIGINT, it will not display done because the job was moved to the fg earlier!
+        job->status = DONE;
+        job->end_time = process->end_time;
+        if (job->cgroup_fd >= 0)
+        {
+            // the final figures, then the leaf goes away
+            close_job_cgroup(job);
+        }
+        // like bash, a pipeline exits with the status of its last stage
+        for (process_t *last = job->first_process; last != NULL; last = last->next)
+        {
+            job->exit_code = last->exit_code;
+        }
+        note_done_job(job);
+        if (job->server_client != NULL)
+        {
+            finish_server_job(job);
+        }
+        if (job->background)
+        {
+            background_jobs_done++;
+        }
+        if (job->parallel)
+        {
+            // hand the slot to the next queued command right away instead of at the next prompt
+            job->parallel = 0;
+            parallel_queue.running--;
+            start_parallel_jobs();
+        }
+    }
+    else if (WIFSTOPPED(status) && job_is_stopped(job))
+    {
+        // then this process group with pgid was STOPPED
+        job->status = STOPPED;
+        if (WSTOPSIG(status) == SIGTSTP || WSTOPSIG(status) == SIGSTOP)
+        {
+            job->background = 1;
+            if (job->job_number == FG_JOB_NUM)
+            {
+                // this means we are transitioning a foreground job in to the background
+                // because of foreground jobs blocking stdin, we can be assured there will only ever be one at a given time
+                remove_job(job->pgid, 0);
+                job->job_number = find_most_recent_job_num() + 1;
+                add_job(job);
+            }
+        }
+        if (job->background)
+        {
+            note_stopped_job(job);
+        }
+        if (job->server_client != NULL)
+        {
+            send_job_reply(job, "stopped");
+        }
+    }
+    return 1;
+}
+
+int job_is_completed(job_t *job)
+{
+    for (process_t *process = job->first_process; process != NULL; process = process->next)
+    {
+        if (!process->completed)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int job_is_stopped(job_t *job)
+{
+    // a job is stopped once every stage that is still alive has stopped
+    for (process_t *process = job->first_process; process != NULL; process = process->next)
+    {
+        if (!process->completed && !process->stopped)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int update_job_table_statuses()
+{
+    // only reap when a SIGCHLD arrived since the last time, otherwise no child changed state
+    if (!drain_child_notifications())
+    {
+        return 0;
+    }
+    int status;
+    pid_t pid;
+    struct rusage usage;
+    int updated = 0;
+    // signals coalesce, so collect every child that changed state since the notification
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED, &usage)) > 0)
+    {
+        update_job_status(status, pid, &usage);
+        updated++;
+    }
+    return updated;
+}
+
+void update_job_command_str(job_t *job, int apply_bg)
+{
+    int len = strlen(job->command);
+    // a command of one or two characters can't end in " &", and must not be read before its start
+    int has_bg_suffix = (len >= 2 && job->command[len - 1] == '&' && job->command[len - 2] == ' ');
+    if (apply_bg)
+    {
+        if (has_bg_suffix)
+        {
+            // suffix already included, no update required
+            return;
+        }
+        char bg_suffix[] = " &";
+        // the old string stays in the arena until the job is freed
+        char *updated_command = (char *)arena_alloc(job->arena, (len + 3) * sizeof(char));
+        memset(updated_command, '\0', (len + 3) * sizeof(char));
+        strcat(updated_command, job->command);
+        strcat(updated_command, bg_suffix);
+        job->command = updated_command;
+    }
+    else
+    {
+        // we're updating a string from the bg to the fg
+        if (!has_bg_suffix)
+        {
+            // suffix not present, no need for removal
+            return;
+        }
+        // remove the background job suffix via null termination!
+        job->command[len - 1] = '\0';
         job->command[len - 2] = '\0';
     }
 }
 
-// ==== JOB DATA STRUCTURE FUNCTIONS ==== //
-
-void add_job(job_t *job)
+// ==== SCRIPT INPUT FUNCTIONS ==== //
+
+int parse_arguments(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], STARTUP_STATS_FLAG) == 0)
+    {
+        // yash --startup-stats [the usual arguments]
+        startup_stats = 1;
+        return parse_arguments(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], SERVER_FLAG) == 0)
+    {
+        // yash --listen /path/to/socket
+        if (argc < 3)
+        {
+            printf("yash: %s: option requires an argument\n", SERVER_FLAG);
+            return -1;
+        }
+        interactive = 0;
+        server_socket_path = argv[2];
+        return SUCCESS;
+    }
+    if (argc > 1 && strcmp(argv[1], COMMAND_STRING_FLAG) == 0)
+    {
+        // yash -c 'commands'
+        if (argc < 3)
+        {
+            printf("yash: -c: option requires an argument\n");
+            return -1;
+        }
+        interactive = 0;
+        open_string_reader(&script_reader, argv[2]);
+        return SUCCESS;
+    }
+    if (argc > 1)
+    {
+        // yash script.sh
+        int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            print_file_redirection_error_str(argv[1]);
+            return -1;
+        }
+        interactive = 0;
+        return open_script_reader(&script_reader, fd);
+    }
+    // plain yash, only interactive when a user is actually at a terminal
+    interactive = isatty(STDIN_FILENO);
+    if (!interactive)
+    {
+        return open_script_reader(&script_reader, STDIN_FILENO);
+    }
+    return SUCCESS;
+}
+
+int open_script_reader(script_reader_t *reader, int fd)
+{
+    memset(reader, 0, sizeof(script_reader_t));
+    reader->fd = fd;
+    struct stat st;
+    // a regular file that isn't stdin can be mapped in one go, stdin has to stay readable by the commands we run
+    if (fd != STDIN_FILENO && fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        reader->mapped = 1;
+        reader->length = st.st_size;
+        if (st.st_size == 0)
+        {
+            return SUCCESS;
+        }
+        reader->buffer = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (reader->buffer != MAP_FAILED)
+        {
+            madvise(reader->buffer, st.st_size, MADV_SEQUENTIAL);
+            return SUCCESS;
+        }
+        reader->mapped = 0;
+        reader->length = 0;
+    }
+    // pipes, ttys and unmappable files are read in large chunks, and lines are cut out of the buffer
+    // NOTE: commands reading from the shell's stdin won't see input the shell already buffered
+    reader->capacity = SCRIPT_READ_CHUNK;
+    reader->buffer = (char *)malloc(reader->capacity);
+    return SUCCESS;
+}
+
+void open_string_reader(script_reader_t *reader, char *str)
+{
+    memset(reader, 0, sizeof(script_reader_t));
+    reader->fd = -1;
+    reader->buffer = str;
+    reader->length = strlen(str);
+    reader->mapped = 1;
+}
+
+char *read_script_line(script_reader_t *reader, size_t *len)
+{
+    while (1)
+    {
+        char *start = reader->buffer + reader->position;
+        size_t available = reader->length - reader->position;
+        char *newline = (available > 0) ? (char *)memchr(start, '\n', available) : NULL;
+        if (newline != NULL)
+        {
+            *len = newline - start;
+            reader->position += *len + 1;
+            return start;
+        }
+        if (reader->mapped || reader->eof)
+        {
+            if (available == 0)
+            {
+                return NULL;
+            }
+            // last line without a trailing newline
+            *len = available;
+            reader->position = reader->length;
+            return start;
+        }
+        // no full line buffered: move the partial line to the front, make room and read more
+        memmove(reader->buffer, start, available);
+        reader->length = available;
+        reader->position = 0;
+        if (reader->length == reader->capacity)
+        {
+            reader->capacity *= 2;
+            reader->buffer = (char *)realloc(reader->buffer, reader->capacity);
+        }
+        ssize_t bytes_read = read(reader->fd, reader->buffer + reader->length, reader->capacity - reader->length);
+        if (bytes_read < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_read <= 0)
+        {
+            reader->eof = 1;
+            continue;
+        }
+        reader->length += bytes_read;
+    }
+}
+
+void read_here_documents(job_t *job)
+{
+    // the lines after a command with << are its text, up to a line holding just the delimiter
+    // a list can have several, they are read in the order they appear
+    for (; job != NULL; job = job->list_next)
+    {
+        for (process_t *process = job->first_process; process != NULL; process = process->next)
+        {
+            for (redirect_t *redirect = process->redirects; redirect != NULL; redirect = redirect->next)
+            {
+                if (redirect->delimiter != NULL)
+                {
+                    read_here_document(redirect, job);
+                }
+            }
+        }
+    }
+}
+
+void read_here_document(redirect_t *redirect, job_t *job)
+{
+    // the lines up to one holding just the delimiter
+    char *text;
+    size_t text_length;
+    FILE *stream = open_memstream(&text, &text_length);
+    size_t delimiter_length = strlen(redirect->delimiter);
+    while (1)
+    {
+        size_t line_length;
+        char *line = interactive ? read_command(HERE_DOCUMENT_PROMPT) : read_script_line(&script_reader, &line_length);
+        if (line == NULL)
+        {
+            printf("-yash: warning: here-document delimited by end-of-file (wanted `%s')\n", redirect->delimiter);
+            break;
+        }
+        if (interactive)
+        {
+            line_length = strlen(line);
+        }
+        int done = (line_length == delimiter_length && memcmp(line, redirect->delimiter, line_length) == 0);
+        if (!done)
+        {
+            fwrite(line, 1, line_length, stream);
+            fputc('\n', stream);
+        }
+        if (interactive)
+        {
+            free(line);
+        }
+        if (done)
+        {
+            break;
+        }
+    }
+    fclose(stream);
+    redirect->text = arena_strndup(job->arena, text, text_length);
+    redirect->text_length = text_length;
+    redirect->delimiter = NULL;
+    free(text);
+}
+
+void report_done_jobs()
+{
+    // bash only prints job notifications for interactive shells, done jobs are cleaned up either way
+    if (interactive)
+    {
+        print_done_jobs();
+    }
+    remove_done_jobs();
+}
+
+// ==== EVENT LOOP FUNCTIONS ==== //
+
+int init_child_notifications()
+{
+    // SIGCHLD has to be blocked for it to be queued on the signalfd instead of being delivered
+    sigset_t sigchld_mask;
+    sigemptyset(&sigchld_mask);
+    sigaddset(&sigchld_mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &sigchld_mask, NULL) < 0)
+    {
+        return -1;
+    }
+    sigchld_fd = signalfd(-1, &sigchld_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigchld_fd < 0)
+    {
+        // fall back to reaping every time the job table is updated
+        sigprocmask(SIG_UNBLOCK, &sigchld_mask, NULL);
+        return -1;
+    }
+    event_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (event_fd >= 0 && add_event_source(sigchld_fd, EVENT_CHILD_SIGNAL, 0) < 0)
+    {
+        close(event_fd);
+        event_fd = -1;
+    }
+    return SUCCESS;
+}
+
+int drain_child_notifications()
+{
+    if (sigchld_fd < 0)
+    {
+        // no signalfd, so there is no way to tell and we always have to check
+        return 1;
+    }
+    struct signalfd_siginfo info;
+    int notified = 0;
+    while (read(sigchld_fd, &info, sizeof(info)) == sizeof(info))
+    {
+        notified = 1;
+    }
+    return notified;
+}
+
+int add_event_source(int fd, enum event_source source, int value)
+{
+    if (event_fd < 0)
+    {
+        return -1;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = EVENT_TAG(source, value);
+    return epoll_ctl(event_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+void remove_event_source(int fd)
+{
+    // explicitly, a forked child that hasn't exec'd yet may still hold a copy that keeps the registration alive
+    if (event_fd >= 0)
+    {
+        epoll_ctl(event_fd, EPOLL_CTL_DEL, fd, NULL);
+    }
+}
+
+int wait_for_events(job_t *job, int *terminal_ready)
+{
+    // one epoll_wait for the keyboard, every child and every capture pipe, then handle whatever woke us up
+    // job is the foreground job whose cached output is being collected, if any
+    struct epoll_event events[EVENT_BATCH_SIZE];
+    int count = epoll_wait(event_fd, events, EVENT_BATCH_SIZE, -1);
+    if (count < 0)
+    {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        int value = EVENT_VALUE(events[i].data.u64);
+        switch (EVENT_SOURCE(events[i].data.u64))
+        {
+        case EVENT_TERMINAL:
+            *terminal_ready = 1;
+            break;
+        case EVENT_CHILD_SIGNAL:
+            update_job_table_statuses();
+            break;
+        case EVENT_PROCESS:
+            reap_process(value);
+            break;
+        case EVENT_OUTPUT_RING:
+            if (value < output_ring_capacity && output_rings[value] != NULL)
+            {
+                drain_output_ring(output_rings[value]);
+            }
+            break;
+        case EVENT_CACHE:
+            if (job != NULL && job->cache != NULL)
+            {
+                read_cached_output(job);
+            }
+            break;
+        case EVENT_COPROC:
+            read_coproc_output(value);
+            break;
+        case EVENT_SERVER:
+            accept_server_clients();
+            break;
+        case EVENT_SERVER_CLIENT:
+        {
+            server_client_t *client = find_server_client(value);
+            if (client != NULL && (events[i].events & EPOLLOUT))
+            {
+                flush_server_client(client);
+            }
+            if (client != NULL && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+            {
+                read_server_client(client);
+            }
+            break;
+        }
+        }
+    }
+    return 0;
+}
+
+int wait_for_child_events()
+{
+    // sleeps until a child changes state, in the event loop so the capture rings keep being drained meanwhile
+    // (a background job writing more than a pipe buffer would otherwise block, and never finish)
+    if (event_fd >= 0)
+    {
+        int terminal_ready = 0;
+        return wait_for_events(NULL, &terminal_ready);
+    }
+    // no epoll set, so there are no capture rings either
+    int status;
+    struct rusage usage;
+    pid_t pid = wait4(-1, &status, WUNTRACED, &usage);
+    if (pid < 0)
+    {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    update_job_status(status, pid, &usage);
+    return 0;
+}
+
+void track_process(process_t *process, int pidfd)
+{
+    // substitutions are never in the pid table, SIGCHLD reaps them like before
+    if (process->substitution_type != TOKEN_WORD)
+    {
+        if (pidfd >= 0)
+        {
+            close(pidfd);
+        }
+        return;
+    }
+    // the shell is the parent and reaps its children itself, so the pid still names our child here
+    if (pidfd < 0 && !pidfd_unavailable)
+    {
+        pidfd = syscall(SYS_pidfd_open, process->pid, 0);
+        // older kernels, or a seccomp filter, the shell still has SIGCHLD
+        pidfd_unavailable = (pidfd < 0 && errno == ENOSYS);
+    }
+    process->pidfd = pidfd;
+    if (pidfd >= 0)
+    {
+        add_event_source(pidfd, EVENT_PROCESS, process->pid);
+    }
+}
+
+void reap_process(pid_t pid)
+{
+    // a readable pidfd means exactly that process exited, reap it without looking at any other child
+    process_t *process;
+    job_t *job = find_process_job(pid, &process);
+    if (job == NULL || process->pidfd < 0)
+    {
+        return;
+    }
+    siginfo_t info;
+    struct rusage usage;
+    memset(&info, 0, sizeof(info));
+    // the raw syscall, glibc's waitid has no rusage argument
+    if (syscall(SYS_waitid, P_PIDFD, process->pidfd, &info, WEXITED | WNOHANG, &usage) < 0 || info.si_pid == 0)
+    {
+        return;
+    }
+    // back to a wait status, so all the bookkeeping stays in update_job_status
+    int status = (info.si_code == CLD_EXITED) ? W_EXITCODE(info.si_status, 0)
+                                              : info.si_status | ((info.si_code == CLD_DUMPED) ? WCOREFLAG : 0);
+    update_job_status(status, pid, &usage);
+}
+
+void release_process_pidfd(process_t *process)
+{
+    if (process->pidfd >= 0)
+    {
+        remove_event_source(process->pidfd);
+        close(process->pidfd);
+        process->pidfd = -1;
+    }
+}
+
+void init_line_editor()
+{
+    // deferred until the first prompt, scripts and -c never get here
+    // a shell without a history file still works, it just doesn't remember anything
+    history_file_open();
+    note_startup_phase("history");
+    rl_add_defun("yash-history-prefix-search", history_prefix_search_command, -1);
+    rl_bind_keyseq(HISTORY_SEARCH_KEYSEQ, history_prefix_search_command);
+    rl_attempted_completion_function = complete_line;
+    // reads the terminal description and inputrc, otherwise done by the first rl_callback_handler_install
+    rl_initialize();
+    note_startup_phase("line_editor");
+    finish_startup();
+}
+
+char *read_command(const char *prompt)
+{
+    static int line_editor_ready;
+    if (!line_editor_ready)
+    {
+        init_line_editor();
+        line_editor_ready = 1;
+    }
+    // readline's callback interface lets us wait on the terminal, the children and captured output at the same time
+    // without the epoll set readline just blocks on the terminal, and finished jobs are reported at the next prompt
+    int watching_terminal = (add_event_source(STDIN_FILENO, EVENT_TERMINAL, 0) == 0);
+
+    pending_command = NULL;
+    command_ready = 0;
+    active_prompt = prompt;
+    rl_callback_handler_install(prompt, handle_command_line);
+    while (!command_ready)
+    {
+        int terminal_ready = !watching_terminal;
+        if (watching_terminal && wait_for_events(NULL, &terminal_ready) < 0)
+        {
+            // treat a broken event loop like an EOF
+            rl_callback_handler_remove();
+            break;
+        }
+        if (background_jobs_done > 0 || coproc_output_ready)
+        {
+            notify_done_jobs();
+        }
+        if (terminal_ready)
+        {
+            rl_callback_read_char();
+        }
+    }
+    if (watching_terminal)
+    {
+        // typing ahead while a command runs must not wake up the foreground wait
+        remove_event_source(STDIN_FILENO);
+    }
+    return pending_command;
+}
+
+void handle_command_line(char *line)
+{
+    // called by readline once a full line (or an EOF, as NULL) was read
+    // removing the handler here keeps readline from redrawing the prompt before the command runs
+    rl_callback_handler_remove();
+    pending_command = line;
+    command_ready = 1;
+}
+
+void notify_done_jobs()
+{
+    // print "Done" jobs while the user is still typing, without losing what they typed
+    int saved_point = rl_point;
+    char *saved_line = rl_copy_text(0, rl_end);
+    rl_set_prompt("");
+    rl_replace_line("", 0);
+    rl_redisplay();
+
+    print_done_jobs();
+    remove_done_jobs();
+    background_jobs_done = 0;
+    // answers to send -b that came in at the prompt
+    print_coproc_responses();
+
+    rl_set_prompt(active_prompt);
+    rl_replace_line(saved_line, 0);
+    rl_point = saved_point;
+    rl_redisplay();
+    free(saved_line);
+}
+
+// ==== SERVER MODE ==== //
+
+void run_server(const char *path)
+{
+    // a supervisor talks to the shell through a UNIX socket instead of a terminal, many requests can be in flight at once
+    // the jobs are reaped through the same epoll set as the connections, nothing here ever waits on a single job
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        printf("-yash: %s: socket path too long\n", path);
+        exit_shell(EXIT_FAILURE);
+    }
+    strcpy(address.sun_path, path);
+    if (event_fd < 0)
+    {
+        printf("-yash: %s: server mode needs the epoll event loop\n", path);
+        exit_shell(EXIT_FAILURE);
+    }
+    // a socket left behind by a server that is gone is replaced, anything else at the path is an error
+    struct stat path_stat;
+    if (lstat(path, &path_stat) == 0 && S_ISSOCK(path_stat.st_mode))
+    {
+        unlink(path);
+    }
+    server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server_fd < 0 || bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(server_fd, SERVER_BACKLOG) < 0)
+    {
+        perror("-yash: server socket");
+        if (server_fd >= 0)
+        {
+            close(server_fd);
+            server_fd = -1;
+        }
+        exit_shell(EXIT_FAILURE);
+    }
+    add_event_source(server_fd, EVENT_SERVER, 0);
+    while (1)
+    {
+        int terminal_ready = 0;
+        if (wait_for_events(NULL, &terminal_ready) < 0)
+        {
+            perror("-yash: server");
+            exit_shell(EXIT_FAILURE);
+        }
+        // without a pidfd a job is only reaped through SIGCHLD, whose event may have come in the same batch as the request
+        update_job_table_statuses();
+        report_done_jobs();
+        close_finished_server_clients();
+    }
+}
+
+void accept_server_clients()
+{
+    int fd;
+    while ((fd = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        server_client_t *client = (server_client_t *)calloc(1, sizeof(server_client_t));
+        client->fd = fd;
+        client->next = server_clients;
+        server_clients = client;
+        update_server_client_events(client);
+    }
+}
+
+server_client_t *find_server_client(int fd)
+{
+    server_client_t *client = server_clients;
+    while (client != NULL && client->fd != fd)
+    {
+        client = client->next;
+    }
+    return client;
+}
+
+void read_server_client(server_client_t *client)
+{
+    // runs every full line that came in, a client can write many requests without waiting for a reply
+    while (!client->eof && !client->broken)
+    {
+        if (client->input_capacity - client->input_length < SERVER_READ_CHUNK)
+        {
+            client->input_capacity = (client->input_capacity == 0) ? SERVER_READ_CHUNK * 2 : client->input_capacity * 2;
+            client->input = (char *)realloc(client->input, client->input_capacity);
+        }
+        ssize_t bytes_read = read(client->fd, client->input + client->input_length, client->input_capacity - client->input_length);
+        if (bytes_read < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_read < 0 && errno == EAGAIN)
+        {
+            return;
+        }
+        if (bytes_read <= 0)
+        {
+            // like the last line of a script, a request without its newline still runs
+            client->eof = 1;
+            update_server_client_events(client);
+            if (client->input_length > 0)
+            {
+                run_server_request(client, client->input, client->input_length);
+                client->input_length = 0;
+            }
+            return;
+        }
+        size_t scanned = client->input_length;
+        client->input_length += bytes_read;
+        size_t start = 0;
+        char *newline;
+        while ((newline = (char *)memchr(client->input + scanned, '\n', client->input_length - scanned)) != NULL)
+        {
+            run_server_request(client, client->input + start, newline - (client->input + start));
+            start = newline - client->input + 1;
+            scanned = start;
+        }
+        memmove(client->input, client->input + start, client->input_length - start);
+        client->input_length -= start;
+        if (client->input_length > SERVER_MAX_LINE)
+        {
+            send_server_reply(client, "request=%d event=error message=line too long\n", client->requests + 1);
+            client->eof = 1;
+        }
+    }
+}
+
+void run_server_request(server_client_t *client, char *line, size_t length)
+{
+    // one command line, run like a script line with a & at its end
+    int request = ++client->requests;
+    if (length > 0 && line[length - 1] == '\r')
+    {
+        length--;
+    }
+    job_t *job = parse_job_line(line, length);
+    if (job == NULL)
+    {
+        // empty lines and syntax errors, the parser printed what was wrong
+        send_server_reply(client, "request=%d event=error\n", request);
+        return;
+    }
+    // a list has to wait for each of its jobs and a here-document would have to come from the socket too, neither fits a request
+    int has_here_document = 0;
+    for (process_t *process = job->first_process; process != NULL; process = process->next)
+    {
+        for (redirect_t *redirect = process->redirects; redirect != NULL; redirect = redirect->next)
+        {
+            has_here_document |= (redirect->delimiter != NULL);
+        }
+    }
+    if (job->list_next != NULL || has_here_document)
+    {
+        send_server_reply(client, "request=%d event=error message=%s\n", request,
+                          has_here_document ? "here-documents are not supported" : "one job per request");
+        free_job_list(job);
+        return;
+    }
+    job = expand_job(job);
+    if (job == NULL)
+    {
+        send_server_reply(client, "request=%d event=error\n", request);
+        return;
+    }
+    if (execute_custom_commands(job))
+    {
+        // builtins run in the shell right away
+        send_server_reply(client, "request=%d event=done job=0 pgid=0 status=%d\n", request, last_exit_status);
+        free_job(job);
+        return;
+    }
+    if (!job->background)
+    {
+        job->background = 1;
+        update_job_command_str(job, 1);
+    }
+    job->server_client = client;
+    job->server_request = request;
+    execute_job(job);
+}
+
+void send_server_reply(server_client_t *client, const char *format, ...)
+{
+    char reply[SERVER_REPLY_SIZE];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(reply, sizeof(reply), format, args);
+    va_end(args);
+    if (length < 0)
+    {
+        return;
+    }
+    if ((size_t)length >= sizeof(reply))
+    {
+        length = sizeof(reply) - 1;
+        reply[length - 1] = '\n';
+    }
+    if (client->output_length + length > client->output_capacity)
+    {
+        client->output_capacity = (client->output_capacity == 0) ? SERVER_READ_CHUNK : client->output_capacity;
+        while (client->output_length + length > client->output_capacity)
+        {
+            client->output_capacity *= 2;
+        }
+        client->output = (char *)realloc(client->output, client->output_capacity);
+    }
+    memcpy(client->output + client->output_length, reply, length);
+    client->output_length += length;
+    flush_server_client(client);
+}
+
+void send_job_reply(job_t *job, const char *event)
+{
+    // started, stopped and done, done jobs also carry their exit status
+    if (job->status == DONE)
+    {
+        send_server_reply(job->server_client, "request=%d event=%s job=%d pgid=%d status=%d\n", job->server_request, event, job->job_number,
+                          job->pgid, job->exit_code);
+    }
+    else
+    {
+        send_server_reply(job->server_client, "request=%d event=%s job=%d pgid=%d\n", job->server_request, event, job->job_number, job->pgid);
+    }
+}
+
+void finish_server_job(job_t *job)
+{
+    // the last reply for a job, a client that stopped writing is closed after the last of its jobs (see close_finished_server_clients)
+    send_job_reply(job, "done");
+    job->server_client->jobs_running--;
+    job->server_client = NULL;
+}
+
+void flush_server_client(server_client_t *client)
+{
+    // never blocks, whatever the socket doesn't take now goes out once epoll says it is writable
+    if (client->broken)
+    {
+        client->output_length = 0;
+        return;
+    }
+    size_t sent = 0;
+    while (sent < client->output_length)
+    {
+        ssize_t bytes_sent = send(client->fd, client->output + sent, client->output_length - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (bytes_sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_sent < 0 && errno == EAGAIN)
+        {
+            break;
+        }
+        if (bytes_sent < 0)
+        {
+            // the client went away, its jobs keep running without anyone to tell
+            client->broken = 1;
+            client->output_length = 0;
+            return;
+        }
+        sent += bytes_sent;
+    }
+    memmove(client->output, client->output + sent, client->output_length - sent);
+    client->output_length -= sent;
+    update_server_client_events(client);
+}
+
+void update_server_client_events(server_client_t *client)
+{
+    // reading until the client shut down its end, writing only while replies are queued
+    uint32_t events = (client->eof ? 0 : EPOLLIN) | ((client->output_length > 0) ? EPOLLOUT : 0);
+    if (events == client->events)
+    {
+        return;
+    }
+    struct epoll_event event;
+    event.events = events;
+    event.data.u64 = EVENT_TAG(EVENT_SERVER_CLIENT, client->fd);
+    // an fd registered for nothing would still report hangups, so it is taken out instead
+    int operation = (events == 0) ? EPOLL_CTL_DEL : (client->events == 0) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    epoll_ctl(event_fd, operation, client->fd, (events == 0) ? NULL : &event);
+    client->events = events;
+}
+
+void close_finished_server_clients()
+{
+    // only here, with no request being run, so nothing still holds on to a client that goes away
+    server_client_t *client = server_clients;
+    while (client != NULL)
+    {
+        server_client_t *next = client->next;
+        if (client->broken || (client->eof && client->jobs_running == 0 && client->output_length == 0))
+        {
+            close_server_client(client);
+        }
+        client = next;
+    }
+}
+
+void close_server_client(server_client_t *client)
+{
+    // the jobs it started are left running, they just stop reporting
+    for (int job_num = 1; job_num <= job_table.highest_job_num; job_num++)
+    {
+        job_t *job = job_table.jobs[job_num];
+        if (job != NULL && job->server_client == client)
+        {
+            job->server_client = NULL;
+        }
+    }
+    server_client_t **link = &server_clients;
+    while (*link != client)
+    {
+        link = &(*link)->next;
+    }
+    *link = client->next;
+    if (client->events != 0)
+    {
+        remove_event_source(client->fd);
+    }
+    close(client->fd);
+    free(client->input);
+    free(client->output);
+    free(client);
+}
+
+// ==== COMMAND PATH CACHE ==== //
+
+const char *resolve_command(const char *name)
+{
+    if (strchr(name, '/') != NULL)
+    {
+        // paths are used as they are
+        return name;
+    }
+    command_cache_check_path();
+    command_cache_entry_t *entry = command_cache_lookup(name);
+    if (entry == NULL)
+    {
+        char *path = search_path(name, command_cache.path_env);
+        if (path == NULL)
+        {
+            return NULL;
+        }
+        command_cache_insert(name, path);
+        entry = command_cache_lookup(name);
+    }
+    entry->hits++;
+    return entry->path;
+}
+
+char *search_path(const char *name, const char *path_env)
+{
+    // same search order as execvp, but done once by the shell
+    size_t name_len = strlen(name);
+    const char *dir = path_env;
+    while (1)
+    {
+        const char *end = strchr(dir, ':');
+        size_t dir_len = (end != NULL) ? (size_t)(end - dir) : strlen(dir);
+        char *path = (char *)malloc(dir_len + name_len + 3);
+        if (dir_len == 0)
+        {
+            // an empty PATH entry means the current directory
+            path[0] = '.';
+            dir_len = 1;
+        }
+        else
+        {
+            memcpy(path, dir, dir_len);
+        }
+        path[dir_len] = '/';
+        memcpy(path + dir_len + 1, name, name_len + 1);
+
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0)
+        {
+            return path;
+        }
+        free(path);
+        if (end == NULL)
+        {
+            return NULL;
+        }
+        dir = end + 1;
+    }
+}
+
+command_cache_entry_t *command_cache_lookup(const char *name)
+{
+    if (command_cache.buckets == NULL)
+    {
+        return NULL;
+    }
+    command_cache_entry_t *entry = command_cache.buckets[hash_string(name) % command_cache.bucket_count];
+    while (entry != NULL && strcmp(entry->name, name) != 0)
+    {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+void command_cache_insert(const char *name, char *path)
+{
+    // takes ownership of path
+    if (command_cache.buckets == NULL)
+    {
+        command_cache.bucket_count = COMMAND_CACHE_INITIAL_BUCKETS;
+        command_cache.buckets = (command_cache_entry_t **)calloc(command_cache.bucket_count, sizeof(command_cache_entry_t *));
+    }
+    else if (command_cache.count >= command_cache.bucket_count)
+    {
+        command_cache_grow();
+    }
+    command_cache_entry_t *entry = (command_cache_entry_t *)malloc(sizeof(command_cache_entry_t));
+    entry->name = strdup(name);
+    entry->path = path;
+    entry->hits = 0;
+    int bucket = hash_string(name) % command_cache.bucket_count;
+    entry->next = command_cache.buckets[bucket];
+    command_cache.buckets[bucket] = entry;
+    command_cache.count++;
+}
+
+void command_cache_forget(const char *name)
+{
+    if (command_cache.buckets == NULL)
+    {
+        return;
+    }
+    command_cache_entry_t **curr = &command_cache.buckets[hash_string(name) % command_cache.bucket_count];
+    while (*curr != NULL)
+    {
+        if (strcmp((*curr)->name, name) == 0)
+        {
+            command_cache_entry_t *entry = *curr;
+            *curr = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            command_cache.count--;
+            return;
+        }
+        curr = &(*curr)->next;
+    }
+}
+
+void command_cache_clear()
+{
+    for (int i = 0; i < command_cache.bucket_count; i++)
+    {
+        command_cache_entry_t *entry = command_cache.buckets[i];
+        while (entry != NULL)
+        {
+            command_cache_entry_t *next = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            entry = next;
+        }
+        command_cache.buckets[i] = NULL;
+    }
+    command_cache.count = 0;
+}
+
+void command_cache_check_path()
+{
+    // every entry depends on PATH, so a changed PATH invalidates the whole cache
+    const char *path_env = getenv("PATH");
+    if (path_env == NULL)
+    {
+        path_env = DEFAULT_PATH;
+    }
+    if (command_cache.path_env != NULL && strcmp(command_cache.path_env, path_env) == 0)
+    {
+        return;
+    }
+    command_cache_clear();
+    free(command_cache.path_env);
+    command_cache.path_env = strdup(path_env);
+}
+
+void command_cache_grow()
+{
+    int new_bucket_count = command_cache.bucket_count * 2;
+    command_cache_entry_t **new_buckets = (command_cache_entry_t **)calloc(new_bucket_count, sizeof(command_cache_entry_t *));
+    for (int i = 0; i < command_cache.bucket_count; i++)
+    {
+        command_cache_entry_t *entry = command_cache.buckets[i];
+        while (entry != NULL)
+        {
+            command_cache_entry_t *next = entry->next;
+            int bucket = hash_string(entry->name) % new_bucket_count;
+            entry->next = new_buckets[bucket];
+            new_buckets[bucket] = entry;
+            entry = next;
+        }
+    }
+    free(command_cache.buckets);
+    command_cache.buckets = new_buckets;
+    command_cache.bucket_count = new_bucket_count;
+}
+
+unsigned int hash_string(const char *str)
+{
+    // djb2
+    unsigned int hash = 5381;
+    while (*str != '\0')
+    {
+        hash = hash * 33 + (unsigned char)*str++;
+    }
+    return hash;
+}
+
+unsigned int hash_bytes(const char *data, size_t length)
+{
+    // hash_string for keys with embedded NULs
+    unsigned int hash = 5381;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = hash * 33 + (unsigned char)data[i];
+    }
+    return hash;
+}
+
+// ==== JOB DATA STRUCTURE FUNCTIONS ==== //
+
+void init_job_table()
+{
+    memset(&job_table, 0, sizeof(job_table_t));
+    job_table.capacity = JOB_TABLE_INITIAL_CAPACITY;
+    job_table.jobs = (job_t **)calloc(job_table.capacity, sizeof(job_t *));
+    job_table.pid_bucket_count = PID_TABLE_INITIAL_BUCKETS;
+    job_table.pid_buckets = (process_t **)calloc(job_table.pid_bucket_count, sizeof(process_t *));
+    // an empty table trivially has no stopped jobs
+    job_table.most_recent_stopped_job_valid = 1;
+}
+
+void add_job(job_t *job)
+{
+    // job will already by malloc'ed into existance, and its processes already spawned!
+    if (job->job_number == FG_JOB_NUM)
+    {
+        // because of foreground jobs blocking stdin, there will only ever be one at a given time
+        job_table.fg_job = job;
+    }
+    else
+    {
+        if (job->job_number >= job_table.capacity)
+        {
+            int new_capacity = job_table.capacity;
+            while (job->job_number >= new_capacity)
+            {
+                new_capacity *= 2;
+            }
+            job_table.jobs = (job_t **)realloc(job_table.jobs, new_capacity * sizeof(job_t *));
+            memset(job_table.jobs + job_table.capacity, 0, (new_capacity - job_table.capacity) * sizeof(job_t *));
+            job_table.capacity = new_capacity;
+        }
+        job_table.jobs[job->job_number] = job;
+        if (job->job_number > job_table.highest_job_num)
+        {
+            job_table.highest_job_num = job->job_number;
+        }
+    }
+    for (process_t *process = job->first_process; process != NULL; process = process->next)
+    {
+        process->job = job;
+        pid_table_insert(process);
+    }
+}
+
+void detach_job(job_t *job)
+{
+    // take a job out of the table without freeing it
+    if (job_table.fg_job == job)
+    {
+        job_table.fg_job = NULL;
+    }
+    else if (job->job_number > 0 && job->job_number < job_table.capacity && job_table.jobs[job->job_number] == job)
+    {
+        job_table.jobs[job->job_number] = NULL;
+        // keep the highest job number pointing at an occupied slot (amortized O(1), each slot is only skipped once)
+        while (job_table.highest_job_num > 0 && job_table.jobs[job_table.highest_job_num] == NULL)
+        {
+            job_table.highest_job_num--;
+        }
+    }
+    for (process_t *process = job->first_process; process != NULL; process = process->next)
+    {
+        pid_table_remove(process);
+    }
+    if (job_table.most_recent_stopped_job == job)
+    {
+        job_table.most_recent_stopped_job = NULL;
+        job_table.most_recent_stopped_job_valid = 0;
+    }
+}
+
+void note_stopped_job(job_t *job)
+{
+    // a newly stopped background job only replaces the cached one if it is more recent
+    if (!job_table.most_recent_stopped_job_valid)
+    {
+        return;
+    }
+    job_t *cached = job_table.most_recent_stopped_job;
+    if (cached == NULL || cached->job_number < job->job_number)
+    {
+        job_table.most_recent_stopped_job = job;
+    }
+}
+
+void note_done_job(job_t *job)
+{
+    // keep the list in job number order so notifications come out like a scan of the table would print them
+    // (only the jobs finished since the last prompt are on it, so the walk is short)
+    job_t **link = &job_table.done_jobs;
+    while (*link != NULL && (*link)->job_number < job->job_number)
+    {
+        link = &(*link)->done_next;
+    }
+    job->done_next = *link;
+    *link = job;
+}
+
+void remove_done_jobs()
+{
+    // any done notifications were printed right before this, only the jobs on the done list are touched
+    // a script never shows its done jobs to anyone, so the status of a background job is kept for a later wait
+    // (server mode reports every job over its socket instead)
+    background_jobs_done = 0;
+    while (job_table.done_jobs != NULL)
+    {
+        job_t *job = job_table.done_jobs;
+        job_table.done_jobs = job->done_next;
+        if (job->timed)
+        {
+            print_job_times(job);
+            job->timed = 0;
+        }
+        if (!interactive && server_fd < 0 && job->background && !job->waited)
+        {
+            save_job_status(job);
+        }
+        detach_job(job);
+        free_job(job);
+    }
+}
+
+void save_job_status(job_t *job)
+{
+    // every stage's pid can be waited for, so each gets a slot with the job's status
+    for (process_t *process = job->first_process; process != NULL; process = process->next)
+    {
+        if (process->pid <= 0)
+        {
+            continue;
+        }
+        saved_status_t *saved = &job_table.saved_statuses[job_table.saved_status_next];
+        if (saved->pid == 0)
+        {
+            job_table.saved_status_count++;
+        }
+        saved->pid = process->pid;
+        saved->pgid = job->pgid;
+        saved->job_number = job->job_number;
+        saved->exit_code = job->exit_code;
+        job_table.saved_status_next = (job_table.saved_status_next + 1) % SAVED_STATUS_MAX;
+    }
+}
+
+int find_saved_status(const char *spec)
+{
+    // only %N and pids, the current and previous jobs are whatever is still in the table
+    // newest first, job numbers and pids may have been handed out again since
+    if (job_table.saved_status_count == 0)
+    {
+        return -1;
+    }
+    int job_num = (spec[0] == JOB_SPEC_PREFIX) ? atoi(spec + 1) : 0;
+    pid_t pid = (spec[0] == JOB_SPEC_PREFIX) ? 0 : atoi(spec);
+    if (job_num <= 0 && pid <= 0)
+    {
+        return -1;
+    }
+    for (int i = 1; i <= SAVED_STATUS_MAX; i++)
+    {
+        int slot = (job_table.saved_status_next - i + SAVED_STATUS_MAX) % SAVED_STATUS_MAX;
+        saved_status_t *saved = &job_table.saved_statuses[slot];
+        if (saved->pid != 0 && ((pid > 0) ? saved->pid == pid : saved->job_number == job_num))
+        {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+void forget_saved_status(int slot)
+{
+    // a status is reported once, the slots of the job's other stages go with it
+    saved_status_t found = job_table.saved_statuses[slot];
+    for (int i = 0; i < SAVED_STATUS_MAX; i++)
+    {
+        saved_status_t *saved = &job_table.saved_statuses[i];
+        if (saved->pid != 0 && saved->pgid == found.pgid && saved->job_number == found.job_number)
+        {
+            saved->pid = 0;
+            job_table.saved_status_count--;
+        }
+    }
+}
+
+int remove_job(pid_t pgid, int fg_free)
+{
+    // because of fg and bg (moving fg to a bg process), we may not want to completely free a job!
+    // fg_free indicates that we just want to detach a job from the job table to reinsert as a "bg" job
+    job_t *job = find_job(pgid);
+    if (job == NULL)
+    {
+        return 0;
+    }
+    detach_job(job);
+    if (fg_free)
+    {
+        free_job(job);
+    }
+    return 1;
+}
+
+job_t *find_job(pid_t pgid)
+{
+    // the pgid is the pid of the first stage of the job
+    process_t *process = pid_table_lookup(pgid);
+    if (process == NULL || process->job->pgid != pgid)
+    {
+        // printf("Job with pgid: [%d] not found!\n", pgid);
+        return NULL;
+    }
+    return process->job;
+}
+
+job_t *find_process_job(pid_t pid, process_t **process)
+{
+    // find the job owning the pipeline stage with this pid
+    *process = pid_table_lookup(pid);
+    if (*process == NULL)
+    {
+        return NULL;
+    }
+    return (*process)->job;
+}
+
+void pid_table_insert(process_t *process)
+{
+    if (job_table.pid_count >= job_table.pid_bucket_count * PID_TABLE_MAX_LOAD)
+    {
+        pid_table_grow();
+    }
+    int bucket = process->pid % job_table.pid_bucket_count;
+    process->pid_next = job_table.pid_buckets[bucket];
+    job_table.pid_buckets[bucket] = process;
+    job_table.pid_count++;
+}
+
+void pid_table_remove(process_t *process)
+{
+    process_t **curr = &job_table.pid_buckets[process->pid % job_table.pid_bucket_count];
+    while (*curr != NULL)
+    {
+        if (*curr == process)
+        {
+            *curr = process->pid_next;
+            process->pid_next = NULL;
+            job_table.pid_count--;
+            return;
+        }
+        curr = &(*curr)->pid_next;
+    }
+}
+
+process_t *pid_table_lookup(pid_t pid)
+{
+    if (pid <= 0)
+    {
+        return NULL;
+    }
+    process_t *curr = job_table.pid_buckets[pid % job_table.pid_bucket_count];
+    while (curr != NULL && curr->pid != pid)
+    {
+        curr = curr->pid_next;
+    }
+    return curr;
+}
+
+void pid_table_grow()
+{
+    // double the bucket count and rehash every process
+    int new_bucket_count = job_table.pid_bucket_count * 2;
+    process_t **new_buckets = (process_t **)calloc(new_bucket_count, sizeof(process_t *));
+    for (int i = 0; i < job_table.pid_bucket_count; i++)
+    {
+        process_t *curr = job_table.pid_buckets[i];
+        while (curr != NULL)
+        {
+            process_t *next = curr->pid_next;
+            int bucket = curr->pid % new_bucket_count;
+            curr->pid_next = new_buckets[bucket];
+            new_buckets[bucket] = curr;
+            curr = next;
+        }
+    }
+    free(job_table.pid_buckets);
+    job_table.pid_buckets = new_buckets;
+    job_table.pid_bucket_count = new_bucket_count;
+}
+
+void print_job_table(int print_running_jobs, int print_stopped_jobs, int print_done_jobs, int verbose)
+{
+    int most_recent_job_num = find_most_recent_job_num();
+    if (most_recent_job_num == 0)
+    {
+        // there are currently no background jobs in the job table
+        return;
+    }
+    // there are background jobs listed, walk them in job number order
+    job_t *curr;
+    int job_status;
+    int is_most_recent_job;
+    for (int job_num = 1; job_num <= job_table.highest_job_num; job_num++)
+    {
+        curr = job_table.jobs[job_num];
+        if (curr == NULL)
+        {
+            continue;
+        }
+        job_status = curr->status;
+        is_most_recent_job = (most_recent_job_num == curr->job_number) ? 1 : 0;
+        if (job_status == RUNNING && print_running_jobs == 1 && curr->background)
+        {
+            print_job(curr, is_most_recent_job, 0, 0, verbose);
+        }
+        else if (job_status == STOPPED && print_stopped_jobs == 1 && curr->background)
+        {
+            print_job(curr, is_most_recent_job, 0, 0, verbose);
+        }
+        else if (job_status == DONE && print_done_jobs == 1 && curr->background)
+        {
+            print_job(curr, is_most_recent_job, 0, 0, verbose);
+        }
+    }
+}
+
+void print_done_jobs()
+{
+    // the "Done" notifications, O(1) when nothing finished
+    if (job_table.done_jobs == NULL)
+    {
+        return;
+    }
+    int most_recent_job_num = find_most_recent_job_num();
+    for (job_t *job = job_table.done_jobs; job != NULL; job = job->done_next)
+    {
+        if (job->background)
+        {
+            print_job(job, most_recent_job_num == job->job_number, 0, 0, 0);
+        }
+    }
+}
+
+// ==== CUSTOM COMMAND FUNCTIONS ==== //
+int execute_custom_commands(job_t *job)
+{
+    // builtins run inside the shell when they are the whole job, they fork like any other command in pipelines or with &
+    process_t *process = job->first_process;
+    if (process->next != NULL || job->background || process->substitutions != NULL)
+    {
+        return 0;
+    }
+    builtin_t *builtin = find_builtin(process->argv[0]);
+    if (builtin == NULL)
+    {
+        return 0;
+    }
+    if (!job->timed)
+    {
+        last_exit_status = run_builtin(builtin, process);
+        return 1;
+    }
+    // time on a builtin measures the shell itself
+    struct rusage before;
+    getrusage(RUSAGE_SELF, &before);
+    clock_gettime(CLOCK_MONOTONIC, &job->start_time);
+    last_exit_status = run_builtin(builtin, process);
+    clock_gettime(CLOCK_MONOTONIC, &job->end_time);
+    getrusage(RUSAGE_SELF, &process->usage);
+    timersub(&process->usage.ru_utime, &before.ru_utime, &process->usage.ru_utime);
+    timersub(&process->usage.ru_stime, &before.ru_stime, &process->usage.ru_stime);
+    print_job_times(job);
+    return 1;
+}
+
+builtin_t *find_builtin(const char *name)
+{
+    for (int i = 0; i < BUILTIN_COUNT; i++)
+    {
+        if (strcmp(builtins[i].name, name) == 0)
+        {
+            return &builtins[i];
+        }
+    }
+    return NULL;
+}
+
+int run_builtin(builtin_t *builtin, process_t *process)
+{
+    // redirect the shell's own fds around the builtin, saving only the ones that get replaced
+    if (process->redirects == NULL)
+    {
+        return builtin->handler(process->argv);
+    }
+    int saved_fds[REDIRECT_FD_LIMIT];
+    int replaced[REDIRECT_FD_LIMIT] = {0};
+    // apply_file_redirects may clobber stdin on failure, so stdin is always saved when anything is redirected
+    replaced[STDIN_FILENO] = 1;
+    saved_fds[STDIN_FILENO] = save_fd(STDIN_FILENO);
+    for (redirect_t *redirect = process->redirects; redirect != NULL; redirect = redirect->next)
+    {
+        if (!replaced[redirect->fd])
+        {
+            replaced[redirect->fd] = 1;
+            saved_fds[redirect->fd] = save_fd(redirect->fd);
+        }
+    }
+    int status = EXIT_FAILURE;
+    if (apply_file_redirects(process) == SUCCESS)
+    {
+        status = builtin->handler(process->argv);
+    }
+    // output buffered by the builtin belongs to the redirected stdout
+    fflush(stdout);
+    for (int fd = 0; fd < REDIRECT_FD_LIMIT; fd++)
+    {
+        if (replaced[fd])
+        {
+            restore_fd(saved_fds[fd], fd);
+        }
+    }
+    return status;
+}
+
+int save_fd(int fd)
+{
+    // close-on-exec so that commands started by the builtin (fg) don't inherit the copies
+    return fcntl(fd, F_DUPFD_CLOEXEC, SAVED_FD_MIN);
+}
+
+void restore_fd(int saved_fd, int fd)
+{
+    if (saved_fd < 0)
+    {
+        // fd wasn't open before, so whatever a redirect put there goes away
+        close(fd);
+        return;
+    }
+    dup2(saved_fd, fd);
+    close(saved_fd);
+}
+
+int execute_bg(char *argv[])
+{
+    (void)argv;
+    // job statuses may have finished executing in the time of commandline processing to executing this command
+    update_job_table_statuses();
+    job_t *bg_job = find_next_job_to_bg();
+    if (bg_job == NULL)
+    {
+        // there are no stopped background jobs, so just end execution
+        return EXIT_FAILURE;
+    }
+    // update command associated with job to match BASH format when bringing a job into the foreground
+    update_job_command_str(bg_job, 1);
+    int most_recent_job_num = find_most_recent_job_num();
+    int is_most_recent_job = (most_recent_job_num == bg_job->job_number) ? 1 : 0;
+    bg_job->status = RUNNING;
+    print_job(bg_job, is_most_recent_job, 1, 0, 0);
+    // santity check
+    bg_job->background = 1;
+    // send SIGCONT to bg_job pg, and wait for it in the background
+    continue_background_job(bg_job, 0);
+    return EXIT_SUCCESS;
+}
+
+job_t *find_next_job_to_bg()
+{
+    // the most recent stopped background job, served from the cache while it is still stopped in the background
+    job_t *cached = job_table.most_recent_stopped_job;
+    if (job_table.most_recent_stopped_job_valid && (cached == NULL || (cached->background && cached->status == STOPPED)))
+    {
+        return cached;
+    }
+    // the cached job was continued or removed, so look for the next most recent one
+    job_t *job_to_continue = NULL;
+    for (int job_num = job_table.highest_job_num; job_num > 0; job_num--)
+    {
+        job_t *curr = job_table.jobs[job_num];
+        if (curr != NULL && curr->background && curr->status == STOPPED)
+        {
+            job_to_continue = curr;
+            break;
+        }
+    }
+    job_table.most_recent_stopped_job = job_to_continue;
+    job_table.most_recent_stopped_job_valid = 1;
+    return job_to_continue;
+}
+
+int execute_fg(char *argv[])
+{
+    (void)argv;
+    // job statuses may have finished executing in the time of commandline processing to executing this command
+    update_job_table_statuses();
+    job_t *fg_job = find_next_job_to_fg();
+    if (fg_job == NULL)
+    {
+        // there are no running or stopped background jobs, so just end execution
+        return EXIT_FAILURE;
+    }
+    // don't need to update the job number: we can't enter any new commands (and thus no new jobs) since this job will be in the foreground
+    // update command associated with job to match BASH format when bringing a job into the foreground
+    update_job_command_str(fg_job, 0);
+    int most_recent_job_num = find_most_recent_job_num();
+    int is_most_recent_job = (most_recent_job_num == fg_job->job_number) ? 1 : 0;
+    fg_job->status = RUNNING;
+    print_job(fg_job, is_most_recent_job, 1, 1, 0);
+    // make sure the job in the job list is no longer a background job
+    // do this after finding the most recent job to account for the fact that it might be latest stopped job
+    fg_job->background = 0;
+    // send SIGCONT to fg_job pg, and wait for it in the foreground
+    continue_background_job(fg_job, 1);
+    return EXIT_SUCCESS;
+}
+
+job_t *find_next_job_to_fg()
+{
+    // exclude done jobs, but also be sure to take into account if the job already notified the terminal if it was completed
+    // the foreground job was always the last one added, so it takes priority over the numbered jobs
+    if (job_table.fg_job != NULL && job_table.fg_job->status != DONE)
+    {
+        return job_table.fg_job;
+    }
+    // done jobs are cleaned up every prompt, so this usually stops at the highest job number
+    for (int job_num = job_table.highest_job_num; job_num > 0; job_num--)
+    {
+        job_t *curr = job_table.jobs[job_num];
+        if (curr != NULL && curr->status != DONE)
+        {
+            return curr;
+        }
+    }
+    return NULL;
+}
+
+int execute_jobs(char *argv[])
+{
+    // job statuses may have finished executing in the time of commandline processing to executing this command
+    update_job_table_statuses();
+    // print DONE jobs
+    print_done_jobs();
+    // we have to do this due to the manner in which the execution of the shell while loop works
+    remove_done_jobs();
+    // jobs -v adds the resource usage of every job
+    int verbose = (argv[1] != NULL && strcmp(argv[1], VERBOSE_FLAG) == 0);
+    print_job_table(1, 1, 0, verbose);
+    return EXIT_SUCCESS;
+}
+
+int execute_hash(char *argv[])
+{
+    command_cache_check_path();
+    if (argv[1] == NULL)
+    {
+        // list the cache in the bash format
+        if (command_cache.count == 0)
+        {
+            printf("hash: hash table empty\n");
+            return EXIT_SUCCESS;
+        }
+        printf("hits\tcommand\n");
+        for (int i = 0; i < command_cache.bucket_count; i++)
+        {
+            for (command_cache_entry_t *entry = command_cache.buckets[i]; entry != NULL; entry = entry->next)
+            {
+                printf("%4d\t%s\n", entry->hits, entry->path);
+            }
+        }
+        return EXIT_SUCCESS;
+    }
+    if (strcmp(argv[1], "-r") == 0)
+    {
+        command_cache_clear();
+        return EXIT_SUCCESS;
+    }
+    // hash name... resolves and remembers each name without running it
+    int status = EXIT_SUCCESS;
+    for (int i = 1; argv[i] != NULL; i++)
+    {
+        command_cache_forget(argv[i]);
+        if (resolve_command(argv[i]) == NULL)
+        {
+            printf("-yash: hash: %s: not found\n", argv[i]);
+            status = EXIT_FAILURE;
+            continue;
+        }
+        // resolving counted as a hit, but the command didn't run
+        command_cache_lookup(argv[i])->hits = 0;
+    }
+    return status;
+}
+
+int execute_parallel(char *argv[])
+{
+    // parallel [-j N] command [args...] ::: arg...
+    // runs command once per arg as background jobs, at most N at a time (default: one per online core)
+    int max_running = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int ind = 1;
+    if (argv[ind] != NULL && strcmp(argv[ind], PARALLEL_JOBS_FLAG) == 0)
+    {
+        if (argv[ind + 1] == NULL || (max_running = atoi(argv[ind + 1])) <= 0)
+        {
+            printf("-yash: parallel: %s needs a positive number of jobs\n", PARALLEL_JOBS_FLAG);
+            return EXIT_FAILURE;
+        }
+        ind += 2;
+    }
+    int template_start = ind;
+    while (argv[ind] != NULL && strcmp(argv[ind], PARALLEL_SEPARATOR) != 0)
+    {
+        ind++;
+    }
+    if (ind == template_start || argv[ind] == NULL)
+    {
+        printf("-yash: parallel: usage: parallel [%s N] command [args...] %s arg...\n", PARALLEL_JOBS_FLAG, PARALLEL_SEPARATOR);
+        return EXIT_FAILURE;
+    }
+    for (int arg = ind + 1; argv[arg] != NULL; arg++)
+    {
+        parallel_enqueue(build_parallel_command(argv + template_start, ind - template_start, argv[arg]));
+    }
+    // the latest limit applies to everything still queued
+    if (max_running < 1)
+    {
+        max_running = 1;
+    }
+    parallel_queue.max_running = max_running;
+    start_parallel_jobs();
+    return EXIT_SUCCESS;
+}
+
+int execute_wait(char *argv[])
+{
+    // wait [%job|pid ...]: block until the given background jobs (or all of them, queued parallel commands included) are done
+    // exits with the status of the last job given, done notifications go out through report_done_jobs afterwards
+    update_job_table_statuses();
+    int target_count = 0;
+    while (argv[target_count + 1] != NULL)
+    {
+        target_count++;
+    }
+    job_t **targets = (job_t **)malloc((target_count + 1) * sizeof(job_t *));
+    // a target that was already freed answers with its saved status, -1 while the last one has none
+    int last_saved_status = -1;
+    for (int i = 0; i < target_count; i++)
+    {
+        targets[i] = find_job_spec(argv[i + 1]);
+        if (targets[i] == NULL)
+        {
+            int slot = find_saved_status(argv[i + 1]);
+            if (slot >= 0)
+            {
+                last_saved_status = (i == target_count - 1) ? job_table.saved_statuses[slot].exit_code : last_saved_status;
+                forget_saved_status(slot);
+            }
+            else if (argv[i + 1][0] == JOB_SPEC_PREFIX)
+            {
+                printf("-yash: wait: %s: no such job\n", argv[i + 1]);
+            }
+            else
+            {
+                printf("-yash: wait: pid %s is not a child of this shell\n", argv[i + 1]);
+            }
+        }
+    }
+
+    // the shell ignores SIGINT at the prompt, catch it for the duration so Ctrl-C still gets out of a wait
+    wait_interrupted = 0;
+    struct sigaction interrupt_action;
+    memset(&interrupt_action, 0, sizeof(interrupt_action));
+    interrupt_action.sa_handler = handle_wait_interrupt;
+    if (interactive)
+    {
+        sigaction(SIGINT, &interrupt_action, NULL);
+    }
+    // the shell sleeps until something changes and every job it reaps is updated
+    while (!wait_interrupted && waiting_on_jobs(targets, target_count))
+    {
+        if (wait_for_child_events() < 0)
+        {
+            // ECHILD, nothing left to wait for
+            break;
+        }
+    }
+    if (interactive)
+    {
+        signal(SIGINT, SIG_IGN);
+    }
+
+    // the statuses taken here are not saved again when the done jobs are freed at the end of the line
+    for (int i = 0; i < target_count; i++)
+    {
+        if (targets[i] != NULL && targets[i]->status == DONE)
+        {
+            targets[i]->waited = 1;
+        }
+    }
+    if (target_count == 0 && !wait_interrupted)
+    {
+        for (int job_num = 1; job_num <= job_table.highest_job_num; job_num++)
+        {
+            if (job_table.jobs[job_num] != NULL && job_table.jobs[job_num]->status == DONE)
+            {
+                job_table.jobs[job_num]->waited = 1;
+            }
+        }
+        // a plain wait forgets every status it could have reported
+        memset(job_table.saved_statuses, 0, sizeof(job_table.saved_statuses));
+        job_table.saved_status_count = 0;
+    }
+
+    int exit_status = EXIT_SUCCESS;
+    if (wait_interrupted)
+    {
+        // the terminal echoed ^C without a newline
+        printf("\n");
+        exit_status = 128 + SIGINT;
+    }
+    else if (target_count > 0)
+    {
+        job_t *last = targets[target_count - 1];
+        if (last == NULL)
+        {
+            exit_status = (last_saved_status >= 0) ? last_saved_status : 127;
+        }
+        else
+        {
+            exit_status = (last->status == DONE) ? last->exit_code : 128 + SIGTSTP;
+        }
+    }
+    free(targets);
+    return exit_status;
+}
+
+int execute_history(char *argv[])
+{
+    // history: every entry numbered, history N: only the last N, history -s prefix: the distinct entries starting with prefix
+    if (argv[1] != NULL && strcmp(argv[1], HISTORY_SEARCH_FLAG) == 0)
+    {
+        if (argv[2] == NULL)
+        {
+            printf("-yash: history: %s needs a prefix\n", HISTORY_SEARCH_FLAG);
+            return EXIT_FAILURE;
+        }
+        history_file_build_index();
+        size_t prefix_len = strlen(argv[2]);
+        size_t previous_length = 0;
+        size_t previous = 0;
+        for (size_t i = history_file_lower_bound(argv[2], prefix_len); i < history_file.index_count; i++)
+        {
+            size_t offset = history_file.index[i];
+            size_t length = history_file_entry_length(offset);
+            if (length < prefix_len || memcmp(history_file.map + offset, argv[2], prefix_len) != 0)
+            {
+                break;
+            }
+            // equal entries are next to each other in the index
+            if (i > 0 && length == previous_length && memcmp(history_file.map + offset, history_file.map + previous, length) == 0)
+            {
+                continue;
+            }
+            printf("%.*s\n", (int)length, history_file.map + offset);
+            previous = offset;
+            previous_length = length;
+        }
+        return EXIT_SUCCESS;
+    }
+    history_file_map();
+    long limit = (argv[1] != NULL) ? atol(argv[1]) : -1;
+    long total = 0;
+    for (char *line = history_file.map; line != NULL && line < history_file.map + history_file.map_length;)
+    {
+        char *end = memchr(line, '\n', history_file.map + history_file.map_length - line);
+        total++;
+        line = (end == NULL) ? NULL : end + 1;
+    }
+    long number = 0;
+    for (char *line = history_file.map; line != NULL && line < history_file.map + history_file.map_length;)
+    {
+        char *end = memchr(line, '\n', history_file.map + history_file.map_length - line);
+        size_t length = (end == NULL) ? (size_t)(history_file.map + history_file.map_length - line) : (size_t)(end - line);
+        number++;
+        if (limit < 0 || number > total - limit)
+        {
+            printf("%5ld  %.*s\n", number, (int)length, line);
+        }
+        line = (end == NULL) ? NULL : end + 1;
+    }
+    return EXIT_SUCCESS;
+}
+
+int execute_output(char *argv[])
+{
+    // output [%N]: what a captured background job wrote so far (the most recent job without an argument)
+    drain_output_rings();
+    int job_num = 0;
+    if (argv[1] == NULL)
+    {
+        for (int i = output_ring_capacity - 1; i > 0 && job_num == 0; i--)
+        {
+            job_num = (output_rings[i] != NULL) ? i : 0;
+        }
+    }
+    else
+    {
+        job_num = atoi(argv[1] + (argv[1][0] == JOB_SPEC_PREFIX));
+    }
+    output_ring_t *ring = (job_num > 0 && job_num < output_ring_capacity) ? output_rings[job_num] : NULL;
+    if (ring == NULL)
+    {
+        printf("-yash: output: %s: no captured output (set %s=%s before starting the job)\n", (argv[1] != NULL) ? argv[1] : "%",
+               OUTPUT_CAPTURE_ENV, OUTPUT_CAPTURE_MODE);
+        return EXIT_FAILURE;
+    }
+    fflush(stdout);
+    if (ring->dropped > 0)
+    {
+        fprintf(stderr, "-yash: output: [%d] dropped its first %zu bytes\n", ring->job_number, ring->dropped);
+    }
+    // the ring wraps at most once, so the contents are at most two pieces
+    size_t first = (ring->start + ring->length <= OUTPUT_RING_SIZE) ? ring->length : OUTPUT_RING_SIZE - ring->start;
+    fwrite(ring->data + ring->start, 1, first, stdout);
+    fwrite(ring->data, 1, ring->length - first, stdout);
+    fflush(stdout);
+    return EXIT_SUCCESS;
+}
+
+int execute_cache(char *argv[])
+{
+    // a bare cache lists what the result cache holds, most recently used first
+    (void)argv;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (result_cache_entry_t *entry = result_cache.head; entry != NULL; entry = entry->next)
+    {
+        double left = elapsed_seconds(&now, &entry->expires);
+        printf("%zu bytes\t%.1fs left\thits %d\t%s\n", entry->output_length, (left > 0) ? left : 0, entry->hits, entry->command);
+    }
+    printf("%d cached results, %zu of %d bytes\n", result_cache.count, result_cache.bytes, RESULT_CACHE_MAX_BYTES);
+    return EXIT_SUCCESS;
+}
+
+int execute_ulimit(char *argv[])
+{
+    // ulimit [-S|-H] [-a | -<resource> [limit|unlimited]], like bash both limits are set unless -S or -H is given
+    // the limits are the shell's own (so shell-wide on purpose), every job started afterwards inherits them
+    int soft = 1;
+    int hard = 1;
+    int all = 0;
+    ulimit_resource_t *resource = &ulimit_resources[0];
+    int i = 1;
+    for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0' && argv[i][2] == '\0'; i++)
+    {
+        if (strcmp(argv[i], ULIMIT_SOFT_FLAG) == 0 || strcmp(argv[i], ULIMIT_HARD_FLAG) == 0)
+        {
+            soft = (argv[i][1] == 'S');
+            hard = (argv[i][1] == 'H');
+            continue;
+        }
+        if (strcmp(argv[i], ULIMIT_ALL_FLAG) == 0)
+        {
+            all = 1;
+            continue;
+        }
+        resource = NULL;
+        for (int j = 0; j < ULIMIT_RESOURCE_COUNT; j++)
+        {
+            resource = (ulimit_resources[j].flag == argv[i][1]) ? &ulimit_resources[j] : resource;
+        }
+        if (resource == NULL)
+        {
+            printf("-yash: ulimit: %s: invalid option\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (all)
+    {
+        for (int j = 0; j < ULIMIT_RESOURCE_COUNT; j++)
+        {
+            print_ulimit(&ulimit_resources[j], !soft, 1);
+        }
+        return EXIT_SUCCESS;
+    }
+    if (argv[i] == NULL)
+    {
+        print_ulimit(resource, !soft, 0);
+        return EXIT_SUCCESS;
+    }
+    rlim_t value = RLIM_INFINITY;
+    if (strcmp(argv[i], ULIMIT_UNLIMITED) != 0)
+    {
+        char *end;
+        unsigned long long number = strtoull(argv[i], &end, 10);
+        if (*end != '\0' || argv[i][0] == '-')
+        {
+            printf("-yash: ulimit: %s: invalid number\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        value = (rlim_t)number * resource->unit;
+    }
+    // the shell's own limits, so every job started from now on inherits them
+    struct rlimit limit;
+    getrlimit(resource->resource, &limit);
+    limit.rlim_cur = soft ? value : limit.rlim_cur;
+    limit.rlim_max = hard ? value : limit.rlim_max;
+    if (setrlimit(resource->resource, &limit) < 0)
+    {
+        printf("-yash: ulimit: %s: cannot modify limit: %s\n", resource->description, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+void print_ulimit(ulimit_resource_t *resource, int hard, int with_description)
+{
+    struct rlimit limit;
+    getrlimit(resource->resource, &limit);
+    rlim_t value = hard ? limit.rlim_max : limit.rlim_cur;
+    if (with_description)
+    {
+        printf("%-28s(-%c) ", resource->description, resource->flag);
+    }
+    if (value == RLIM_INFINITY)
+    {
+        printf("%s\n", ULIMIT_UNLIMITED);
+    }
+    else
+    {
+        printf("%llu\n", (unsigned long long)(value / resource->unit));
+    }
+}
+
+int execute_coproc(char *argv[])
+{
+    // coproc [-n workers] name command [args ...]: start a pool of long lived workers for send
+    // coproc -c name: close the pool's input, the workers see EOF and exit after answering what they already got
+    // coproc: list the pools
+    if (argv[1] == NULL)
+    {
+        for (coproc_pool_t *pool = coproc_pools; pool != NULL; pool = pool->next)
+        {
+            int busy = 0;
+            for (int i = 0; i < pool->worker_count; i++)
+            {
+                busy += pool->workers[i].busy;
+            }
+            printf("[%d]\t%s\t%d workers (%d alive, %d busy)\t%s\n", pool->job->job_number, pool->name, pool->worker_count,
+                   coproc_workers_alive(pool), busy, pool->job->command);
+        }
+        return EXIT_SUCCESS;
+    }
+    if (strcmp(argv[1], COPROC_CLOSE_FLAG) == 0)
+    {
+        coproc_pool_t *pool = (argv[2] != NULL) ? find_coproc_pool(argv[2]) : NULL;
+        if (pool == NULL)
+        {
+            printf("-yash: coproc: %s: no such coprocess\n", (argv[2] != NULL) ? argv[2] : "");
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < pool->worker_count; i++)
+        {
+            // only the shell's sending side, outstanding answers still come in until the worker exits
+            if (pool->workers[i].fd >= 0)
+            {
+                shutdown(pool->workers[i].fd, SHUT_WR);
+                pool->workers[i].busy = 1;
+            }
+        }
+        return EXIT_SUCCESS;
+    }
+    int worker_count = 1;
+    int i = 1;
+    if (strcmp(argv[1], COPROC_WORKERS_FLAG) == 0)
+    {
+        worker_count = (argv[2] != NULL) ? atoi(argv[2]) : 0;
+        i = 3;
+    }
+    if (worker_count <= 0 || worker_count > COPROC_MAX_WORKERS)
+    {
+        printf("-yash: coproc: %s: worker count must be between 1 and %d\n", (argv[2] != NULL) ? argv[2] : "", COPROC_MAX_WORKERS);
+        return EXIT_FAILURE;
+    }
+    if (argv[i] == NULL || argv[i + 1] == NULL)
+    {
+        printf("-yash: coproc: usage: coproc [-n workers] name command [args ...]\n");
+        return EXIT_FAILURE;
+    }
+    if (find_coproc_pool(argv[i]) != NULL)
+    {
+        printf("-yash: coproc: %s: already running\n", argv[i]);
+        return EXIT_FAILURE;
+    }
+    if (event_fd < 0)
+    {
+        // the answers are collected by the event loop
+        printf("-yash: coproc: not available without signalfd and epoll\n");
+        return EXIT_FAILURE;
+    }
+    return start_coproc_pool(argv[i], worker_count, argv + i + 1);
+}
+
+int execute_send(char *argv[])
+{
+    // send [-b] name [request ...]: the words as one line to an idle worker of the pool, its one line answer goes to stdout
+    // with -b several workers can be busy at once, their answers come out at the end of the command line, at the prompt,
+    // or when a send has to wait for a free worker
+    int background = (argv[1] != NULL && strcmp(argv[1], SEND_BACKGROUND_FLAG) == 0);
+    char *name = argv[1 + background];
+    coproc_pool_t *pool = (name != NULL) ? find_coproc_pool(name) : NULL;
+    if (pool == NULL)
+    {
+        printf("-yash: send: %s: no such coprocess\n", (name != NULL) ? name : "");
+        return EXIT_FAILURE;
+    }
+    coproc_worker_t *worker;
+    while ((worker = find_idle_worker(pool)) == NULL && coproc_workers_alive(pool))
+    {
+        // every worker is busy, the first one to answer takes the request
+        if (wait_for_events(NULL, NULL) < 0)
+        {
+            break;
+        }
+        print_coproc_responses();
+    }
+    if (worker == NULL)
+    {
+        printf("-yash: send: %s: every worker exited\n", name);
+        return EXIT_FAILURE;
+    }
+    char *request = NULL;
+    size_t request_length = 0;
+    FILE *stream = open_memstream(&request, &request_length);
+    for (int i = 2 + background; argv[i] != NULL; i++)
+    {
+        fprintf(stream, (i > 2 + background) ? " %s" : "%s", argv[i]);
+    }
+    fputc('\n', stream);
+    fclose(stream);
+    // a socket instead of a pipe, so a worker that just died is an EPIPE here and not a SIGPIPE for the shell
+    ssize_t result = 0;
+    for (size_t written = 0; written < request_length && result >= 0; written += (result > 0) ? result : 0)
+    {
+        result = send(worker->fd, request + written, request_length - written, MSG_NOSIGNAL);
+        result = (result < 0 && errno == EINTR) ? 0 : result;
+    }
+    free(request);
+    if (result < 0)
+    {
+        printf("-yash: send: %s: %s\n", name, strerror(errno));
+        close_coproc_worker(worker);
+        return EXIT_FAILURE;
+    }
+    worker->busy = 1;
+    if (background)
+    {
+        return EXIT_SUCCESS;
+    }
+    while (!worker->answered && worker->fd >= 0)
+    {
+        if (wait_for_events(NULL, NULL) < 0)
+        {
+            break;
+        }
+    }
+    // only this answer, a redirect of this send shouldn't catch what other workers answered meanwhile
+    int answered = worker->answered;
+    print_coproc_worker(worker);
+    return answered ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+job_t *find_job_spec(const char *spec)
+{
+    // %N is a job number, %% and %+ the most recent job, anything else the pid of one of a job's processes
+    if (spec[0] == JOB_SPEC_PREFIX)
+    {
+        int job_num = (spec[1] == '%' || spec[1] == '+' || spec[1] == '\0') ? find_most_recent_job_num() : atoi(spec + 1);
+        return (job_num > 0 && job_num <= job_table.highest_job_num) ? job_table.jobs[job_num] : NULL;
+    }
+    pid_t pid = atoi(spec);
+    if (pid <= 0)
+    {
+        return NULL;
+    }
+    process_t *process;
+    return find_process_job(pid, &process);
+}
+
+int waiting_on_jobs(job_t *targets[], int target_count)
+{
+    // stopped jobs will not finish by themselves, so they end the wait too
+    if (target_count == 0)
+    {
+        if (parallel_queue.next < parallel_queue.count)
+        {
+            return 1;
+        }
+        for (int job_num = 1; job_num <= job_table.highest_job_num; job_num++)
+        {
+            if (job_table.jobs[job_num] != NULL && job_table.jobs[job_num]->status == RUNNING)
+            {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    for (int i = 0; i < target_count; i++)
+    {
+        if (targets[i] != NULL && targets[i]->status == RUNNING)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void handle_wait_interrupt(int sig)
+{
+    (void)sig;
+    wait_interrupted = 1;
+}
+
+int execute_cd(char *argv[])
+{
+    const char *dir = argv[1];
+    if (dir == NULL)
+    {
+        dir = getenv("HOME");
+        if (dir == NULL)
+        {
+            printf("-yash: cd: HOME not set\n");
+            return EXIT_FAILURE;
+        }
+    }
+    else if (strcmp(dir, "-") == 0)
+    {
+        dir = getenv("OLDPWD");
+        if (dir == NULL)
+        {
+            printf("-yash: cd: OLDPWD not set\n");
+            return EXIT_FAILURE;
+        }
+        printf("%s\n", dir);
+    }
+    char old_dir[FILENAME_MAX];
+    int have_old_dir = (getcwd(old_dir, sizeof(old_dir)) != NULL);
+    if (chdir(dir) < 0)
+    {
+        char error_str[FILENAME_MAX + 100];
+        snprintf(error_str, sizeof(error_str), "-yash: cd: %s", dir);
+        perror(error_str);
+        return EXIT_FAILURE;
+    }
+    if (have_old_dir)
+    {
+        setenv("OLDPWD", old_dir, 1);
+    }
+    char new_dir[FILENAME_MAX];
+    if (getcwd(new_dir, sizeof(new_dir)) != NULL)
+    {
+        setenv("PWD", new_dir, 1);
+    }
+    return EXIT_SUCCESS;
+}
+
+int execute_pwd(char *argv[])
+{
+    (void)argv;
+    char dir[FILENAME_MAX];
+    if (getcwd(dir, sizeof(dir)) == NULL)
+    {
+        perror("-yash: pwd");
+        return EXIT_FAILURE;
+    }
+    printf("%s\n", dir);
+    return EXIT_SUCCESS;
+}
+
+int execute_echo(char *argv[])
+{
+    int ind = 1;
+    int newline = 1;
+    if (argv[1] != NULL && strcmp(argv[1], "-n") == 0)
+    {
+        newline = 0;
+        ind++;
+    }
+    for (; argv[ind] != NULL; ind++)
+    {
+        fputs(argv[ind], stdout);
+        if (argv[ind + 1] != NULL)
+        {
+            putchar(' ');
+        }
+    }
+    if (newline)
+    {
+        putchar('\n');
+    }
+    return EXIT_SUCCESS;
+}
+
+int execute_true(char *argv[])
+{
+    (void)argv;
+    return EXIT_SUCCESS;
+}
+
+int execute_false(char *argv[])
+{
+    (void)argv;
+    return EXIT_FAILURE;
+}
+
+int execute_export(char *argv[])
+{
+    if (argv[1] == NULL)
+    {
+        // list the environment like bash's export -p
+        for (char **env = environ; *env != NULL; env++)
+        {
+            printf("export %s\n", *env);
+        }
+        return EXIT_SUCCESS;
+    }
+    int status = EXIT_SUCCESS;
+    for (int i = 1; argv[i] != NULL; i++)
+    {
+        char *equals = strchr(argv[i], '=');
+        if (equals == NULL)
+        {
+            // there are no unexported shell variables, so a bare name only needs to exist
+            if (getenv(argv[i]) == NULL)
+            {
+                setenv(argv[i], "", 1);
+            }
+            continue;
+        }
+        *equals = '\0';
+        if (argv[i][0] == '\0' || setenv(argv[i], equals + 1, 1) < 0)
+        {
+            printf("-yash: export: `%s=%s': not a valid identifier\n", argv[i], equals + 1);
+            status = EXIT_FAILURE;
+        }
+        *equals = '=';
+    }
+    return status;
+}
+
+int execute_unset(char *argv[])
+{
+    for (int i = 1; argv[i] != NULL; i++)
+    {
+        unsetenv(argv[i]);
+    }
+    return EXIT_SUCCESS;
+}
+
+int execute_exit(char *argv[])
+{
+    exit_shell((argv[1] != NULL) ? atoi(argv[1]) : last_exit_status);
+}
+
+int execute_test(char *argv[])
+{
+    int argc = 0;
+    while (argv[argc] != NULL)
+    {
+        argc++;
+    }
+    if (strcmp(argv[0], "[") == 0)
+    {
+        if (strcmp(argv[argc - 1], "]") != 0)
+        {
+            printf("-yash: [: missing `]'\n");
+            return 2;
+        }
+        argc--;
+    }
+    // evaluate everything after the command name, 0 means true like the exit status
+    return evaluate_test(argc - 1, argv + 1) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int evaluate_test(int argc, char *argv[])
+{
+    // POSIX test by argument count, enough for the usual one-liners
+    if (argc == 0)
+    {
+        return 0;
+    }
+    if (strcmp(argv[0], "!") == 0)
+    {
+        return !evaluate_test(argc - 1, argv + 1);
+    }
+    if (argc == 1)
+    {
+        return argv[0][0] != '\0';
+    }
+    if (argc == 2)
+    {
+        const char *op = argv[0];
+        const char *arg = argv[1];
+        struct stat st;
+        if (strcmp(op, "-n") == 0)
+        {
+            return arg[0] != '\0';
+        }
+        if (strcmp(op, "-z") == 0)
+        {
+            return arg[0] == '\0';
+        }
+        if (strcmp(op, "-e") == 0)
+        {
+            return stat(arg, &st) == 0;
+        }
+        if (strcmp(op, "-f") == 0)
+        {
+            return stat(arg, &st) == 0 && S_ISREG(st.st_mode);
+        }
+        if (strcmp(op, "-d") == 0)
+        {
+            return stat(arg, &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (strcmp(op, "-s") == 0)
+        {
+            return stat(arg, &st) == 0 && st.st_size > 0;
+        }
+        if (strcmp(op, "-r") == 0)
+        {
+            return access(arg, R_OK) == 0;
+        }
+        if (strcmp(op, "-w") == 0)
+        {
+            return access(arg, W_OK) == 0;
+        }
+        if (strcmp(op, "-x") == 0)
+        {
+            return access(arg, X_OK) == 0;
+        }
+        return 0;
+    }
+    if (argc == 3)
+    {
+        const char *left = argv[0];
+        const char *op = argv[1];
+        const char *right = argv[2];
+        if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+        {
+            return strcmp(left, right) == 0;
+        }
+        if (strcmp(op, "!=") == 0)
+        {
+            return strcmp(left, right) != 0;
+        }
+        long l = atol(left);
+        long r = atol(right);
+        if (strcmp(op, "-eq") == 0)
+        {
+            return l == r;
+        }
+        if (strcmp(op, "-ne") == 0)
+        {
+            return l != r;
+        }
+        if (strcmp(op, "-lt") == 0)
+        {
+            return l < r;
+        }
+        if (strcmp(op, "-le") == 0)
+        {
+            return l <= r;
+        }
+        if (strcmp(op, "-gt") == 0)
+        {
+            return l > r;
+        }
+        if (strcmp(op, "-ge") == 0)
+        {
+            return l >= r;
+        }
+        return 0;
+    }
+    return 0;
+}
+
+// ==== DEBUGGING FUNCTIONS ==== //
+
+void print_job(job_t *job, int is_most_recent_job, int custom_command, int command_is_fg, int verbose)
+{
+    char status[20] = "Unknown";
+    memset(status, '\0', sizeof(char) * 20);
+    switch (job->status)
+    {
+    case (RUNNING):
+        strcpy(status, "Running");
+        break;
+    case (STOPPED):
+        strcpy(status, "Stopped");
+        break;
+    case (DONE):
+        strcpy(status, "Done");
+        break;
+    default:
+        break;
+    }
+
+    if (custom_command && command_is_fg)
+    {
+        // means the command "fg" was run, so print the command directly to the terminal
+        // no discrimination whether
+        printf("%s\n", job->command);
+    }
+    else if (is_most_recent_job && custom_command && !command_is_fg)
+    {
+        // printing job in the "jobs" format for the most recent job created
+        printf("[%d]+\t%s\n", job->job_number, job->command);
+    }
+    else if (!is_most_recent_job && custom_command && !command_is_fg)
+    {
+        // printing job in the "jobs" format for previous jobs
+        printf("[%d]-\t%s\n", job->job_number, job->command);
+    }
+    else if (is_most_recent_job && !custom_command)
+    {
+        // printing job in the "job table" format for the most recent job created
+        printf("[%d]+\t%s\t\t\t%s\n", job->job_number, status, job->command);
+    }
+    else if (!is_most_recent_job && !custom_command)
+    {
+        // printing job in the "job table" format for previous jobs
+        printf("[%d]-\t%s\t\t\t%s\n", job->job_number, status, job->command);
+    }
+    if (verbose)
+    {
+        print_job_usage(job);
+    }
+}
+
+void print_job_usage(job_t *job)
+{
+    // per stage usage, then the job total (rusage is only known for stages that already exited)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (process_t *process = job->first_process; process != NULL; process = process->next)
+    {
+        if (!process->completed)
+        {
+            printf("\t%d\t%-12s\t%s\n", process->pid, process->argv[0], process->stopped ? "stopped" : "running");
+            continue;
+        }
+        printf("\t%d\t%-12s\tuser %.3fs\tsys %.3fs\tmaxrss %ldKB\telapsed %.3fs\texit %d\n", process->pid, process->argv[0],
+               timeval_seconds(&process->usage.ru_utime), timeval_seconds(&process->usage.ru_stime), process->usage.ru_maxrss,
+               elapsed_seconds(&job->start_time, &process->end_time), process->exit_code);
+    }
+    struct rusage usage;
+    job_total_usage(job, &usage);
+    printf("\ttotal\t\t\tuser %.3fs\tsys %.3fs\tmaxrss %ldKB\telapsed %.3fs\n", timeval_seconds(&usage.ru_utime),
+           timeval_seconds(&usage.ru_stime), usage.ru_maxrss, elapsed_seconds(&job->start_time, (job->status == DONE) ? &job->end_time : &now));
+    if (job->cgroup_path != NULL && read_cgroup_usage(job))
+    {
+        // the cgroup also counts the running stages and everything they started, which rusage never sees
+        if (job->cgroup_usage.memory_peak >= 0)
+        {
+            printf("\tcgroup\t\t\tuser %.3fs\tsys %.3fs\tmemory peak %ldKB\n", job->cgroup_usage.user_usec / 1e6,
+                   job->cgroup_usage.system_usec / 1e6, job->cgroup_usage.memory_peak / 1024);
+        }
+        else
+        {
+            printf("\tcgroup\t\t\tuser %.3fs\tsys %.3fs\n", job->cgroup_usage.user_usec / 1e6, job->cgroup_usage.system_usec / 1e6);
+        }
+    }
+}
+
+void print_job_times(job_t *job)
+{
+    // the report of the time keyword, in the bash format
+    struct rusage usage;
+    job_total_usage(job, &usage);
+    double times[3] = {elapsed_seconds(&job->start_time, &job->end_time), timeval_seconds(&usage.ru_utime), timeval_seconds(&usage.ru_stime)};
+    const char *labels[3] = {"real", "user", "sys"};
+    fprintf(stderr, "\n");
+    for (int i = 0; i < 3; i++)
+    {
+        int minutes = (int)(times[i] / 60);
+        fprintf(stderr, "%s\t%dm%.3fs\n", labels[i], minutes, times[i] - minutes * 60);
+    }
+}
+
+void job_total_usage(job_t *job, struct rusage *usage)
+{
+    // cpu time adds up over the stages, the peak rss is the largest single stage
+    memset(usage, 0, sizeof(struct rusage));
+    for (process_t *process = job->first_process; process != NULL; process = process->next)
+    {
+        timeradd(&usage->ru_utime, &process->usage.ru_utime, &usage->ru_utime);
+        timeradd(&usage->ru_stime, &process->usage.ru_stime, &usage->ru_stime);
+        if (process->usage.ru_maxrss > usage->ru_maxrss)
+        {
+            usage->ru_maxrss = process->usage.ru_maxrss;
+        }
+    }
+}
+
+double elapsed_seconds(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+double timeval_seconds(struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+int find_most_recent_job_num()
+{
+    // In this case, it okay to include jobs that are DONE. This function is only called in functions where done jobs are printed out before they are erased
+    // so any cases where added bg jobs may appear to be +1 of the latest bg job will never happen since done jobs will be printed first!
+    // a job brought to the foreground with fg keeps its slot but doesn't count, so skip over those
+    for (int job_num = job_table.highest_job_num; job_num > 0; job_num--)
+    {
+        job_t *curr = job_table.jobs[job_num];
+        if (curr != NULL && curr->background)
+        {
+            return job_num;
+        }
+    }
+    return 0;
+}
+
+void free_job_table()
+{
+    for (int job_num = 1; job_num <= job_table.highest_job_num; job_num++)
+    {
+        if (job_table.jobs[job_num] != NULL)
+        {
+            free_job(job_table.jobs[job_num]);
+        }
+    }
+    if (job_table.fg_job != NULL)
+    {
+        free_job(job_table.fg_job);
+    }
+    free(job_table.jobs);
+    free(job_table.pid_buckets);
+    memset(&job_table, 0, sizeof(job_table_t));
+    if (spare_arena != NULL)
+    {
+        arena_destroy(spare_arena);
+        spare_arena = NULL;
+    }
+    command_cache_clear();
+    free(command_cache.buckets);
+    free(command_cache.path_env);
+    memset(&command_cache, 0, sizeof(command_cache_t));
+    free_parallel_queue();
+    history_file_close();
+    free_directory_cache();
+    free_output_rings();
+    free_result_cache();
+}
+
+job_t *create_job(char *command, size_t len)
+{
+    // the job is the first allocation in its own arena, reusing the last freed job's arena when there is one
+    arena_t *arena = acquire_arena();
+    job_t *job = (job_t *)arena_alloc(arena, sizeof(job_t));
+    memset(job, 0, sizeof(job_t));
+    job->arena = arena;
+    job->command = arena_strndup(arena, command, len);
+    return job;
+}
+
+process_t *create_process(job_t *job, int argc)
+{
+    process_t *process = (process_t *)arena_alloc(job->arena, sizeof(process_t));
+    memset(process, 0, sizeof(process_t));
+    process->pidfd = -1;
+    process->argv = (char **)arena_alloc(job->arena, (argc + 1) * sizeof(char *));
+    memset(process->argv, 0, (argc + 1) * sizeof(char *));
+    return process;
+}
+
+void free_job(job_t *job)
+{
+    if (job->cgroup_path != NULL)
+    {
+        // a process substitution may still have been inside when the job finished
+        close_job_cgroup(job);
+    }
+    if (job->cache != NULL)
+    {
+        release_cache_request(job);
+    }
+    if (job->coproc != NULL)
+    {
+        release_coproc_pool(job);
+    }
+    for (process_t *process = job->first_process; process != NULL; process = process->next)
+    {
+        release_process_pidfd(process);
+    }
+    // the job, its processes and all of their strings go away with the arena in one call
+    release_arena(job->arena);
+}
+
+// ==== ARENA ALLOCATOR ==== //
+
+arena_t *acquire_arena()
+{
+    if (spare_arena != NULL)
+    {
+        arena_t *arena = spare_arena;
+        spare_arena = NULL;
+        return arena;
+    }
+    arena_t *arena = (arena_t *)malloc(sizeof(arena_t));
+    memset(arena, 0, sizeof(arena_t));
+    return arena;
+}
+
+void release_arena(arena_t *arena)
+{
+    // keep one arena for the next command (usually the foreground job that just finished), free the rest
+    if (spare_arena == NULL)
+    {
+        arena_reset(arena);
+        spare_arena = arena;
+        return;
+    }
+    arena_destroy(arena);
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    arena_block_t *block = arena->head;
+    if (block == NULL || block->used + size > block->size)
+    {
+        // start a new block, big enough for oversized allocations like very long command lines
+        size_t block_size = (size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE;
+        block = (arena_block_t *)malloc(sizeof(arena_block_t) + block_size);
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena->head;
+        arena->head = block;
+    }
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+char *arena_strdup(arena_t *arena, const char *str)
+{
+    return arena_strndup(arena, str, strlen(str));
+}
+
+char *arena_strndup(arena_t *arena, const char *str, size_t len)
+{
+    char *copy = (char *)arena_alloc(arena, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void arena_reset(arena_t *arena)
+{
+    // free every block but the oldest one, which is kept for reuse
+    arena_block_t *block = arena->head;
+    while (block != NULL && block->next != NULL)
+    {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = block;
+    if (block != NULL)
+    {
+        block->used = 0;
+    }
+}
+
+void arena_destroy(arena_t *arena)
+{
+    arena_block_t *block = arena->head;
+    while (block != NULL)
+    {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(arena);
+}
+
+// ==== SESSION FUNCTIONS ==== //
+
+void exit_shell(int status)
+{
+    if (session_summary)
+    {
+        print_session_summary();
+    }
+#ifdef YASH_TRACE
+    finish_trace();
+#endif
+    if (server_fd >= 0)
+    {
+        unlink(server_socket_path);
+    }
+    free_job_table();
+    exit(status);
+}
+
+void print_session_summary()
+{
+    // totals over every reaped child of the session, enabled with YASH_SESSION_SUMMARY
+    struct rusage usage;
+    struct timespec now;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(stderr, "yash session: jobs %d\telapsed %.3fs\tuser %.3fs\tsys %.3fs\tmaxrss %ldKB\n", session_jobs_run,
+            elapsed_seconds(&session_start_time, &now), timeval_seconds(&usage.ru_utime), timeval_seconds(&usage.ru_stime), usage.ru_maxrss);
+}
+
+void note_startup_phase(const char *phase)
+{
+    // time since the previous phase ended, only with --startup-stats
+    if (!startup_stats)
+    {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(stderr, "yash startup: %-20s %.3fms\n", phase, elapsed_seconds(&startup_phase_start, &now) * 1000);
+    startup_phase_start = now;
+}
+
+void finish_startup()
+{
+    if (!startup_stats)
+    {
+        return;
+    }
+    // loading the binary and its shared libraries happens before main, so it only shows up as cpu time
+    struct timespec now;
+    struct timespec cpu;
+    struct timespec cpu_start = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+    fprintf(stderr, "yash startup: %-20s %.3fms\n", "total", elapsed_seconds(&session_start_time, &now) * 1000);
+    fprintf(stderr, "yash startup: %-20s %.3fms\n", "cpu_incl_loader", elapsed_seconds(&cpu_start, &cpu) * 1000);
+    startup_stats = 0;
+}
+
+// ==== HISTORY ==== //
+
+int history_file_open()
+{
+    // $YASH_HISTFILE, or ~/.yash_history
+    char path[FILENAME_MAX];
+    char *requested_path = getenv(HISTORY_FILE_ENV);
+    char *home = getenv("HOME");
+    if (requested_path != NULL)
+    {
+        snprintf(path, sizeof(path), "%s", requested_path);
+    }
+    else if (home != NULL)
+    {
+        snprintf(path, sizeof(path), "%s/%s", home, HISTORY_FILE_NAME);
+    }
+    else
+    {
+        return -1;
+    }
+    history_file.fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (history_file.fd < 0)
+    {
+        return -1;
+    }
+    history_file.search_match = -1;
+    if (history_file_map() < 0)
+    {
+        return -1;
+    }
+    history_file_load_recent(HISTORY_LOAD_LIMIT);
+    return SUCCESS;
+}
+
+int history_file_map()
+{
+    // (re)map the file when it changed size, other sessions append to it too
+    struct stat file_stat;
+    if (history_file.fd < 0 || fstat(history_file.fd, &file_stat) < 0)
+    {
+        return -1;
+    }
+    size_t length = file_stat.st_size;
+    if (length == history_file.map_length)
+    {
+        return SUCCESS;
+    }
+    if (history_file.map != NULL)
+    {
+        munmap(history_file.map, history_file.map_length);
+        history_file.map = NULL;
+        history_file.map_length = 0;
+    }
+    if (length < history_file.indexed_length)
+    {
+        // the file was truncated underneath us, start the index over
+        history_file.index_count = 0;
+        history_file.indexed_length = 0;
+    }
+    if (length == 0)
+    {
+        return SUCCESS;
+    }
+    char *map = (char *)mmap(NULL, length, PROT_READ, MAP_SHARED, history_file.fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+    history_file.map = map;
+    history_file.map_length = length;
+    return SUCCESS;
+}
+
+void history_file_load_recent(int limit)
+{
+    // walk back from the end of the map to the start of the last limit entries, so startup doesn't depend on the file size
+    size_t end = history_file.map_length;
+    if (end > 0 && history_file.map[end - 1] == '\n')
+    {
+        end--;
+    }
+    size_t first = end;
+    for (int count = 0; count < limit && end > 0; count++)
+    {
+        // end is the newline after the entry being counted, find the one before it
+        char *newline = memrchr(history_file.map, '\n', end);
+        first = (newline == NULL) ? 0 : (size_t)(newline - history_file.map) + 1;
+        end = (first > 0) ? first - 1 : 0;
+    }
+    while (first < history_file.map_length)
+    {
+        size_t length = history_file_entry_length(first);
+        if (length > 0)
+        {
+            char *line = strndup(history_file.map + first, length);
+            add_history(line);
+            free(line);
+        }
+        first += length + 1;
+    }
+}
+
+void history_file_append(const char *line)
+{
+    if (*line == '\0')
+    {
+        return;
+    }
+    // skip a repeat of the previous command, like HISTCONTROL=ignoredups
+    HIST_ENTRY *last = (history_length > 0) ? history_get(history_base + history_length - 1) : NULL;
+    if (last != NULL && strcmp(last->line, line) == 0)
+    {
+        return;
+    }
+    add_history(line);
+    if (history_file.fd < 0)
+    {
+        return;
+    }
+    // a single O_APPEND write per entry, so concurrent sessions never interleave inside an entry
+    struct iovec parts[2] = {{(void *)line, strlen(line)}, {"\n", 1}};
+    if (writev(history_file.fd, parts, 2) < 0)
+    {
+        perror("-yash: history");
+    }
+}
+
+size_t history_file_entry_length(size_t offset)
+{
+    char *end = memchr(history_file.map + offset, '\n', history_file.map_length - offset);
+    return (end == NULL) ? history_file.map_length - offset : (size_t)(end - (history_file.map + offset));
+}
+
+int history_file_compare(const void *a, const void *b)
+{
+    // qsort comparator over entry offsets: by text, older entries first among equal texts
+    size_t offset_a = *(const size_t *)a;
+    size_t offset_b = *(const size_t *)b;
+    size_t length_a = history_file_entry_length(offset_a);
+    size_t length_b = history_file_entry_length(offset_b);
+    int order = memcmp(history_file.map + offset_a, history_file.map + offset_b, (length_a < length_b) ? length_a : length_b);
+    if (order != 0)
+    {
+        return order;
+    }
+    if (length_a != length_b)
+    {
+        return (length_a < length_b) ? -1 : 1;
+    }
+    return (offset_a < offset_b) ? -1 : (offset_a > offset_b);
+}
+
+void history_file_build_index()
+{
+    // only the entries appended since the last search get sorted, then they are merged into the index
+    history_file_map();
+    char *last_newline = (history_file.map_length > 0) ? memrchr(history_file.map, '\n', history_file.map_length) : NULL;
+    // an entry without its newline yet is still being written
+    size_t complete_length = (last_newline == NULL) ? 0 : (size_t)(last_newline - history_file.map) + 1;
+    if (complete_length <= history_file.indexed_length)
+    {
+        return;
+    }
+    size_t new_count = 0;
+    for (char *line = history_file.map + history_file.indexed_length; line < history_file.map + complete_length;)
+    {
+        char *end = memchr(line, '\n', history_file.map + complete_length - line);
+        new_count += (end != line);
+        line = end + 1;
+    }
+    size_t total = history_file.index_count + new_count;
+    if (total > history_file.index_capacity)
+    {
+        size_t capacity = (history_file.index_capacity == 0) ? HISTORY_INDEX_INITIAL_CAPACITY : history_file.index_capacity;
+        while (capacity < total)
+        {
+            capacity *= 2;
+        }
+        history_file.index = (size_t *)realloc(history_file.index, capacity * sizeof(size_t));
+        history_file.index_capacity = capacity;
+    }
+    // the new entries go into a scratch run after the old ones, sorted on their own
+    size_t *new_entries = (size_t *)malloc((new_count + 1) * sizeof(size_t));
+    size_t position = 0;
+    for (char *line = history_file.map + history_file.indexed_length; line < history_file.map + complete_length;)
+    {
+        char *end = memchr(line, '\n', history_file.map + complete_length - line);
+        if (end != line)
+        {
+            new_entries[position++] = line - history_file.map;
+        }
+        line = end + 1;
+    }
+    qsort(new_entries, new_count, sizeof(size_t), history_file_compare);
+    // merge from the back so the existing index can be merged in place
+    size_t old_position = history_file.index_count;
+    size_t new_position = new_count;
+    size_t write_position = total;
+    while (new_position > 0)
+    {
+        if (old_position > 0 && history_file_compare(&history_file.index[old_position - 1], &new_entries[new_position - 1]) > 0)
+        {
+            history_file.index[--write_position] = history_file.index[--old_position];
+        }
+        else
+        {
+            history_file.index[--write_position] = new_entries[--new_position];
+        }
+    }
+    free(new_entries);
+    history_file.index_count = total;
+    history_file.indexed_length = complete_length;
+}
+
+size_t history_file_lower_bound(const char *prefix, size_t prefix_len)
+{
+    // first index position whose entry is not less than prefix, every entry starting with prefix follows from there
+    size_t low = 0;
+    size_t high = history_file.index_count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        size_t offset = history_file.index[middle];
+        size_t length = history_file_entry_length(offset);
+        int order = memcmp(history_file.map + offset, prefix, (length < prefix_len) ? length : prefix_len);
+        if (order < 0 || (order == 0 && length < prefix_len))
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+long history_file_find_prefix(const char *prefix, long before, const char *skip)
+{
+    // the newest entry starting with prefix that is older than offset before (-1: no limit) and isn't the text skip
+    history_file_build_index();
+    size_t prefix_len = strlen(prefix);
+    size_t skip_len = strlen(skip);
+    long best = -1;
+    for (size_t i = history_file_lower_bound(prefix, prefix_len); i < history_file.index_count; i++)
+    {
+        size_t offset = history_file.index[i];
+        size_t length = history_file_entry_length(offset);
+        if (length < prefix_len || memcmp(history_file.map + offset, prefix, prefix_len) != 0)
+        {
+            break;
+        }
+        if ((before >= 0 && (long)offset >= before) || (long)offset <= best)
+        {
+            continue;
+        }
+        if (length == skip_len && memcmp(history_file.map + offset, skip, length) == 0)
+        {
+            continue;
+        }
+        best = offset;
+    }
+    return best;
+}
+
+int history_prefix_search_command(int count, int key)
+{
+    // readline command for M-p: replace the line with the newest entry starting with what was typed before the first press
+    // pressing it again goes on to older entries
+    (void)count;
+    (void)key;
+    if (rl_last_func != history_prefix_search_command || history_file.search_prefix == NULL)
+    {
+        free(history_file.search_prefix);
+        history_file.search_prefix = strndup(rl_line_buffer, rl_point);
+        history_file.search_match = -1;
+    }
+    long match = history_file_find_prefix(history_file.search_prefix, history_file.search_match, rl_line_buffer);
+    if (match < 0)
+    {
+        rl_ding();
+        return 0;
+    }
+    history_file.search_match = match;
+    char *line = strndup(history_file.map + match, history_file_entry_length(match));
+    rl_replace_line(line, 0);
+    rl_point = rl_end;
+    free(line);
+    return 0;
+}
+
+void history_file_close()
+{
+    if (history_file.map != NULL)
+    {
+        munmap(history_file.map, history_file.map_length);
+    }
+    if (history_file.fd >= 0)
+    {
+        close(history_file.fd);
+    }
+    free(history_file.index);
+    free(history_file.search_prefix);
+    memset(&history_file, 0, sizeof(history_file_t));
+    history_file.fd = -1;
+}
+
+// ==== COMPLETION ==== //
+
+char **complete_line(const char *text, int start, int end)
+{
+    // readline's completion hook: command names for the first word of a pipeline stage, file names everywhere else
+    // neither path goes to readline's own filename completion, which would readdir on every TAB
+    (void)end;
+    rl_attempted_completion_over = 1;
+    completion_candidate_count = 0;
+    if (completing_command_word(start) && strchr(text, '/') == NULL)
+    {
+        complete_commands(text);
+    }
+    else
+    {
+        complete_filenames(text);
+    }
+    if (completion_candidate_count == 0)
+    {
+        return NULL;
+    }
+    // a lone directory keeps going (no space after the slash)
+    rl_completion_suppress_append = (completion_candidate_count == 1 && completion_candidates[0][strlen(completion_candidates[0]) - 1] == '/');
+    return rl_completion_matches(text, completion_generator);
+}
+
+char *completion_generator(const char *text, int state)
+{
+    // readline calls this with state 0 first and frees every string it gets back
+    static int next;
+    (void)text;
+    if (state == 0)
+    {
+        next = 0;
+    }
+    if (next >= completion_candidate_count)
+    {
+        return NULL;
+    }
+    return strdup(completion_candidates[next++]);
+}
+
+int completing_command_word(int start)
+{
+    // the word is a command if only blanks separate it from the start of the line, from ;, |, &, && or ||,
+    // or from the ( of a <( or >( substitution
+    int position = start - 1;
+    while (position >= 0 && (rl_line_buffer[position] == ' ' || rl_line_buffer[position] == '\t'))
+    {
+        position--;
+    }
+    if (position < 0 || rl_line_buffer[position] == ';')
+    {
+        return 1;
+    }
+    char before = (position > 0) ? rl_line_buffer[position - 1] : '\0';
+    if (rl_line_buffer[position] == '|' || rl_line_buffer[position] == '&')
+    {
+        // a file name follows the <| splice and the <& and >& redirects
+        return before != '<' && before != '>';
+    }
+    return rl_line_buffer[position] == '(' && (before == '<' || before == '>');
+}
+
+void complete_commands(const char *text)
+{
+    size_t text_len = strlen(text);
+    for (int i = 0; i < BUILTIN_COUNT; i++)
+    {
+        if (strncmp(builtins[i].name, text, text_len) == 0)
+        {
+            add_completion_match(NULL, 0, builtins[i].name, 0);
+        }
+    }
+    // every PATH directory is a cached listing, so a TAB costs one stat per directory once they are loaded
+    char *path_env = getenv("PATH");
+    char *path_copy = strdup((path_env != NULL) ? path_env : DEFAULT_PATH);
+    char *save;
+    for (char *dir = strtok_r(path_copy, ":", &save); dir != NULL; dir = strtok_r(NULL, ":", &save))
+    {
+        directory_listing_t *listing = get_directory_listing(dir);
+        if (listing == NULL)
+        {
+            continue;
+        }
+        int dir_fd = -1;
+        for (int i = directory_lower_bound(listing, text, text_len); i < listing->count; i++)
+        {
+            directory_entry_t *entry = &listing->entries[i];
+            if (strncmp(entry->name, text, text_len) != 0)
+            {
+                break;
+            }
+            if (entry->executable < 0)
+            {
+                // only entries that ever matched a prefix are checked, and only once per listing
+                if (dir_fd < 0)
+                {
+                    dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                }
+                entry->executable = (!entry->is_dir && dir_fd >= 0 && faccessat(dir_fd, entry->name, X_OK, 0) == 0);
+            }
+            if (entry->executable)
+            {
+                add_completion_match(NULL, 0, entry->name, 0);
+            }
+        }
+        if (dir_fd >= 0)
+        {
+            close(dir_fd);
+        }
+    }
+    free(path_copy);
+}
+
+void complete_filenames(const char *text)
+{
+    // split text into the directory to list and the prefix of the name
+    const char *slash = strrchr(text, '/');
+    size_t dir_len = (slash == NULL) ? 0 : (size_t)(slash - text) + 1;
+    const char *prefix = text + dir_len;
+    size_t prefix_len = strlen(prefix);
+    char dir[FILENAME_MAX];
+    if (dir_len == 0)
+    {
+        strcpy(dir, ".");
+    }
+    else
+    {
+        snprintf(dir, sizeof(dir), "%.*s", (int)dir_len, text);
+    }
+    directory_listing_t *listing = get_directory_listing(dir);
+    if (listing == NULL)
+    {
+        return;
+    }
+    for (int i = directory_lower_bound(listing, prefix, prefix_len); i < listing->count; i++)
+    {
+        directory_entry_t *entry = &listing->entries[i];
+        if (strncmp(entry->name, prefix, prefix_len) != 0)
+        {
+            break;
+        }
+        // hidden files only when asked for, like bash
+        if (entry->name[0] == '.' && prefix[0] != '.')
+        {
+            continue;
+        }
+        add_completion_match(text, dir_len, entry->name, entry->is_dir);
+    }
+}
+
+void add_completion_match(const char *dir_part, size_t dir_len, const char *name, int is_dir)
+{
+    if (completion_candidate_count == completion_candidate_capacity)
+    {
+        // the strings of the previous TAB are reused slots, freed as they get overwritten
+        int capacity = (completion_candidate_capacity == 0) ? COMPLETION_MATCHES_INITIAL_CAPACITY : completion_candidate_capacity * 2;
+        completion_candidates = (char **)realloc(completion_candidates, capacity * sizeof(char *));
+        memset(completion_candidates + completion_candidate_capacity, 0, (capacity - completion_candidate_capacity) * sizeof(char *));
+        completion_candidate_capacity = capacity;
+    }
+    size_t name_len = strlen(name);
+    char *match = (char *)realloc(completion_candidates[completion_candidate_count], dir_len + name_len + 2);
+    if (dir_len > 0)
+    {
+        memcpy(match, dir_part, dir_len);
+    }
+    memcpy(match + dir_len, name, name_len);
+    match[dir_len + name_len] = is_dir ? '/' : '\0';
+    match[dir_len + name_len + 1] = '\0';
+    completion_candidates[completion_candidate_count++] = match;
+}
+
+directory_listing_t *get_directory_listing(const char *path)
+{
+    // a stat per lookup, the readdir only happens when the directory changed since it was cached
+    struct stat dir_stat;
+    if (stat(path, &dir_stat) < 0 || !S_ISDIR(dir_stat.st_mode))
+    {
+        return NULL;
+    }
+    directory_listing_t **link = &directory_cache;
+    while (*link != NULL && strcmp((*link)->path, path) != 0)
+    {
+        link = &(*link)->next;
+    }
+    directory_listing_t *listing = *link;
+    if (listing != NULL)
+    {
+        *link = listing->next;
+        directory_cache_count--;
+        if (listing->mtime.tv_sec != dir_stat.st_mtim.tv_sec || listing->mtime.tv_nsec != dir_stat.st_mtim.tv_nsec)
+        {
+            free_directory_listing(listing);
+            listing = NULL;
+        }
+    }
+    if (listing == NULL)
+    {
+        listing = read_directory_listing(path, &dir_stat.st_mtim);
+        if (listing == NULL)
+        {
+            return NULL;
+        }
+    }
+    // move to the front, and drop the least recently used listing once the cache is full
+    listing->next = directory_cache;
+    directory_cache = listing;
+    directory_cache_count++;
+    if (directory_cache_count > DIRECTORY_CACHE_MAX)
+    {
+        directory_listing_t *last = directory_cache;
+        while (last->next->next != NULL)
+        {
+            last = last->next;
+        }
+        free_directory_listing(last->next);
+        last->next = NULL;
+        directory_cache_count--;
+    }
+    return listing;
+}
+
+directory_listing_t *read_directory_listing(const char *path, struct timespec *mtime)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+    {
+        return NULL;
+    }
+    directory_listing_t *listing = (directory_listing_t *)calloc(1, sizeof(directory_listing_t));
+    listing->path = strdup(path);
+    listing->mtime = *mtime;
+    int entry_capacity = 0;
+    size_t names_length = 0;
+    size_t names_capacity = 0;
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)) != NULL)
+    {
+        if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0)
+        {
+            continue;
+        }
+        size_t name_len = strlen(dirent->d_name) + 1;
+        if (names_length + name_len > names_capacity)
+        {
+            names_capacity = (names_capacity == 0) ? ARENA_BLOCK_SIZE : names_capacity * 2;
+            while (names_length + name_len > names_capacity)
+            {
+                names_capacity *= 2;
+            }
+            listing->names = (char *)realloc(listing->names, names_capacity);
+        }
+        if (listing->count == entry_capacity)
+        {
+            entry_capacity = (entry_capacity == 0) ? COMPLETION_MATCHES_INITIAL_CAPACITY : entry_capacity * 2;
+            listing->entries = (directory_entry_t *)realloc(listing->entries, entry_capacity * sizeof(directory_entry_t));
+        }
+        memcpy(listing->names + names_length, dirent->d_name, name_len);
+        directory_entry_t *entry = &listing->entries[listing->count++];
+        // the name buffer may still move, so keep the offset until it is final
+        entry->name = (char *)names_length;
+        entry->executable = -1;
+        if (dirent->d_type == DT_UNKNOWN || dirent->d_type == DT_LNK)
+        {
+            // some file systems don't fill in d_type, and links are judged by their target
+            struct stat entry_stat;
+            entry->is_dir = (fstatat(dirfd(dir), dirent->d_name, &entry_stat, 0) == 0 && S_ISDIR(entry_stat.st_mode));
+        }
+        else
+        {
+            entry->is_dir = (dirent->d_type == DT_DIR);
+        }
+        names_length += name_len;
+    }
+    closedir(dir);
+    for (int i = 0; i < listing->count; i++)
+    {
+        listing->entries[i].name = listing->names + (size_t)listing->entries[i].name;
+    }
+    if (listing->count > 0)
+    {
+        qsort(listing->entries, listing->count, sizeof(directory_entry_t), compare_directory_entries);
+    }
+    return listing;
+}
+
+int compare_directory_entries(const void *a, const void *b)
+{
+    return strcmp(((const directory_entry_t *)a)->name, ((const directory_entry_t *)b)->name);
+}
+
+int directory_lower_bound(directory_listing_t *listing, const char *prefix, size_t prefix_len)
+{
+    // first entry that is not less than the prefix, all entries starting with it follow
+    int low = 0;
+    int high = listing->count;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (strncmp(listing->entries[middle].name, prefix, prefix_len) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void free_directory_listing(directory_listing_t *listing)
+{
+    free(listing->path);
+    free(listing->entries);
+    free(listing->names);
+    free(listing);
+}
+
+void free_directory_cache()
+{
+    while (directory_cache != NULL)
+    {
+        directory_listing_t *next = directory_cache->next;
+        free_directory_listing(directory_cache);
+        directory_cache = next;
+    }
+    directory_cache_count = 0;
+    for (int i = 0; i < completion_candidate_capacity; i++)
+    {
+        free(completion_candidates[i]);
+    }
+    free(completion_candidates);
+    completion_candidates = NULL;
+    completion_candidate_count = 0;
+    completion_candidate_capacity = 0;
+}
+
+// ==== BACKGROUND OUTPUT CAPTURE ==== //
+
+int start_output_capture(job_t *job)
+{
+    // opt in through YASH_BG_OUTPUT, read per job like the other YASH_* options
+    char *mode = getenv(OUTPUT_CAPTURE_ENV);
+    if (mode == NULL || strcmp(mode, OUTPUT_CAPTURE_MODE) != 0)
+    {
+        return 0;
+    }
+    int pipe_fd[2];
+    if (pipe2(pipe_fd, O_CLOEXEC) < 0)
+    {
+        perror("-yash: output capture");
+        return -1;
+    }
+    // the shell never blocks on a capture pipe, it only reads what is there
+    fcntl(pipe_fd[0], F_SETFL, O_NONBLOCK);
+    if (job->job_number >= output_ring_capacity)
+    {
+        int new_capacity = (output_ring_capacity == 0) ? OUTPUT_RING_TABLE_INITIAL_CAPACITY : output_ring_capacity;
+        while (job->job_number >= new_capacity)
+        {
+            new_capacity *= 2;
+        }
+        output_rings = (output_ring_t **)realloc(output_rings, new_capacity * sizeof(output_ring_t *));
+        memset(output_rings + output_ring_capacity, 0, (new_capacity - output_ring_capacity) * sizeof(output_ring_t *));
+        output_ring_capacity = new_capacity;
+    }
+    // a new job with the same number replaces whatever was captured under it before
+    output_ring_t *ring = output_rings[job->job_number];
+    if (ring == NULL)
+    {
+        ring = (output_ring_t *)malloc(sizeof(output_ring_t));
+        output_rings[job->job_number] = ring;
+    }
+    else
+    {
+        if (ring->fd >= 0)
+        {
+            remove_event_source(ring->fd);
+            close(ring->fd);
+            active_output_rings--;
+        }
+        free(ring->command);
+    }
+    ring->job_number = job->job_number;
+    ring->fd = pipe_fd[0];
+    ring->command = strdup(job->command);
+    ring->start = 0;
+    ring->length = 0;
+    ring->dropped = 0;
+    active_output_rings++;
+    add_event_source(ring->fd, EVENT_OUTPUT_RING, job->job_number);
+    job->capture_fd = pipe_fd[1];
+    return 1;
+}
+
+void drain_output_ring(output_ring_t *ring)
+{
+    // read straight into the free part of the ring, overwriting the oldest bytes once it is full
+    while (ring->fd >= 0)
+    {
+        size_t end = (ring->start + ring->length) % OUTPUT_RING_SIZE;
+        // the free gap before the start, or up to the end of the buffer (which overwrites the oldest bytes once full)
+        size_t space = (end < ring->start) ? ring->start - end : OUTPUT_RING_SIZE - end;
+        ssize_t count = read(ring->fd, ring->data + end, space);
+        if (count > 0)
+        {
+            ring->length += count;
+            if (ring->length > OUTPUT_RING_SIZE)
+            {
+                size_t overflow = ring->length - OUTPUT_RING_SIZE;
+                ring->start = (ring->start + overflow) % OUTPUT_RING_SIZE;
+                ring->length = OUTPUT_RING_SIZE;
+                ring->dropped += overflow;
+            }
+            continue;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            return;
+        }
+        // EOF, every process of the job closed its end
+        remove_event_source(ring->fd);
+        close(ring->fd);
+        ring->fd = -1;
+        active_output_rings--;
+    }
+}
+
+void drain_output_rings()
+{
+    if (active_output_rings == 0)
+    {
+        return;
+    }
+    for (int i = 1; i < output_ring_capacity; i++)
+    {
+        if (output_rings[i] != NULL && output_rings[i]->fd >= 0)
+        {
+            drain_output_ring(output_rings[i]);
+        }
+    }
+}
+
+void wait_in_foreground_capturing(job_t *job)
+{
+    // like the plain wait4 loop, but sleeps in the event loop so the capture pipes and the cached output keep getting drained
+    if (job->cache != NULL && job->cache->read_fd >= 0)
+    {
+        add_event_source(job->cache->read_fd, EVENT_CACHE, 0);
+    }
+    // the job may be done already, its pidfds and SIGCHLD are still readable then
+    while (job->status == RUNNING)
+    {
+        if (wait_for_events(job, NULL) < 0)
+        {
+            break;
+        }
+    }
+    if (job->cache != NULL)
+    {
+        // whatever is left in the pipe once the last stage is gone
+        read_cached_output(job);
+    }
+}
+
+void free_output_rings()
+{
+    for (int i = 0; i < output_ring_capacity; i++)
+    {
+        if (output_rings[i] != NULL)
+        {
+            if (output_rings[i]->fd >= 0)
+            {
+                close(output_rings[i]->fd);
+            }
+            free(output_rings[i]->command);
+            free(output_rings[i]);
+        }
+    }
+    free(output_rings);
+    output_rings = NULL;
+    output_ring_capacity = 0;
+    active_output_rings = 0;
+}
+
+// ==== JOB CGROUPS ==== //
+
+void open_job_cgroup(job_t *job)
+{
+    // a fresh leaf below $YASH_CGROUP for every job, read per job like the other YASH_* options
+    char *parent = getenv(CGROUP_ENV);
+    if (parent == NULL || *parent == '\0')
+    {
+        return;
+    }
+    char path[FILENAME_MAX];
+    snprintf(path, sizeof(path), "%s/yash-%d-%d", parent, shell_pid, ++cgroup_jobs_created);
+    if (mkdir(path, S_IRWXU) < 0)
+    {
+        printf("-yash: %s: %s: %s\n", CGROUP_ENV, path, strerror(errno));
+        return;
+    }
+    job->cgroup_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    job->cgroup_procs_fd = openat(job->cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+    if (job->cgroup_fd < 0 || job->cgroup_procs_fd < 0)
+    {
+        printf("-yash: %s: %s: %s\n", CGROUP_ENV, path, strerror(errno));
+        if (job->cgroup_fd >= 0)
+        {
+            close(job->cgroup_fd);
+        }
+        job->cgroup_fd = -1;
+        job->cgroup_procs_fd = -1;
+        rmdir(path);
+        return;
+    }
+    job->cgroup_path = arena_strdup(job->arena, path);
+    job->cgroup_usage.memory_peak = -1;
+    write_cgroup_limit(job, "memory.max", CGROUP_MEMORY_MAX_ENV);
+    write_cgroup_limit(job, "cpu.max", CGROUP_CPU_MAX_ENV);
+    write_cgroup_limit(job, "pids.max", CGROUP_PIDS_MAX_ENV);
+}
+
+void write_cgroup_limit(job_t *job, const char *file, const char *env_name)
+{
+    char *value = getenv(env_name);
+    if (value == NULL)
+    {
+        return;
+    }
+    // fails when the parent doesn't delegate the controller, the job still runs (and is still accounted)
+    int fd = openat(job->cgroup_fd, file, O_WRONLY | O_CLOEXEC);
+    if (fd < 0 || write(fd, value, strlen(value)) < 0)
+    {
+        printf("-yash: %s: %s/%s: %s\n", env_name, job->cgroup_path, file, strerror(errno));
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+pid_t clone_into_cgroup(job_t *job, int *pidfd)
+{
+    // fork semantics (no shared memory, SIGCHLD to the shell), but the child is born inside the cgroup
+    // and its pidfd comes with it, saving the pidfd_open
+    struct clone_args args;
+    memset(&args, 0, sizeof(args));
+    args.flags = CLONE_INTO_CGROUP | CLONE_PIDFD;
+    args.exit_signal = SIGCHLD;
+    args.cgroup = job->cgroup_fd;
+    args.pidfd = (uint64_t)(uintptr_t)pidfd;
+    pid_t pid = syscall(SYS_clone3, &args, sizeof(args));
+    if (pid < 0 && (errno == ENOSYS || errno == E2BIG || errno == EINVAL))
+    {
+        // an older kernel, or a cgroup clone3 can't place children in, the children move themselves from now on
+        // anything else (EAGAIN, ENOMEM, ...) only sends this one child down the fallback
+        clone3_unavailable = 1;
+    }
+    return pid;
+}
+
+int read_cgroup_usage(job_t *job)
+{
+    // refreshes job->cgroup_usage from the leaf while it exists, the figures of a finished job stay as they were read last
+    if (job->cgroup_fd < 0)
+    {
+        return 1;
+    }
+    char buffer[CGROUP_STAT_BUFFER_SIZE];
+    int fd = openat(job->cgroup_fd, "cpu.stat", O_RDONLY | O_CLOEXEC);
+    ssize_t length = (fd >= 0) ? read(fd, buffer, sizeof(buffer) - 1) : -1;
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    if (length < 0)
+    {
+        return 0;
+    }
+    buffer[length] = '\0';
+    char *user = strstr(buffer, "user_usec ");
+    char *system = strstr(buffer, "system_usec ");
+    job->cgroup_usage.user_usec = (user != NULL) ? atol(user + strlen("user_usec ")) : 0;
+    job->cgroup_usage.system_usec = (system != NULL) ? atol(system + strlen("system_usec ")) : 0;
+    // memory.peak only exists with the memory controller enabled (and a 5.19+ kernel)
+    fd = openat(job->cgroup_fd, "memory.peak", O_RDONLY | O_CLOEXEC);
+    length = (fd >= 0) ? read(fd, buffer, sizeof(buffer) - 1) : -1;
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    if (length > 0)
+    {
+        buffer[length] = '\0';
+        job->cgroup_usage.memory_peak = atol(buffer);
+    }
+    return 1;
+}
+
+void close_job_cgroup(job_t *job)
+{
+    if (job->cgroup_fd >= 0)
+    {
+        read_cgroup_usage(job);
+        close(job->cgroup_fd);
+        close(job->cgroup_procs_fd);
+        job->cgroup_fd = -1;
+        job->cgroup_procs_fd = -1;
+    }
+    // only empty cgroups can be removed, free_job tries again for a leaf that still had processes
+    if (rmdir(job->cgroup_path) == 0 || errno != EBUSY)
+    {
+        job->cgroup_path = NULL;
+    }
+}
+
+// ==== RESULT CACHE ==== //
+
+int parse_cache_keyword(job_t *job, int ind, int token_count, token_t tokens[], char *buffer)
+{
+    // cache [-t seconds] [-w file]..., returns the index of the last token it used
+    cache_request_t *cache = (cache_request_t *)arena_alloc(job->arena, sizeof(cache_request_t));
+    memset(cache, 0, sizeof(cache_request_t));
+    cache->ttl = RESULT_CACHE_DEFAULT_TTL;
+    cache->watch_paths = (char **)arena_alloc(job->arena, token_count * sizeof(char *));
+    cache->read_fd = -1;
+    cache->write_fd = -1;
+    job->cache = cache;
+    while (ind + 2 < token_count && tokens[ind + 1].type == TOKEN_WORD && tokens[ind + 2].type == TOKEN_WORD && !tokens[ind + 1].quoted)
+    {
+        char *option = buffer + tokens[ind + 1].offset;
+        char *value = buffer + tokens[ind + 2].offset;
+        if (strcmp(option, CACHE_TTL_FLAG) == 0)
+        {
+            char *end;
+            cache->ttl = strtod(value, &end);
+            if (*end != '\0' || cache->ttl < 0)
+            {
+                printf("-yash: cache: %s: invalid number of seconds\n", value);
+                return -1;
+            }
+        }
+        else if (strcmp(option, CACHE_WATCH_FLAG) == 0)
+        {
+            cache->watch_paths[cache->watch_count++] = value;
+        }
+        else
+        {
+            break;
+        }
+        ind += 2;
+    }
+    if (ind + 1 == token_count || tokens[ind + 1].type != TOKEN_WORD)
+    {
+        printf("-yash: cache: a command has to follow\n");
+        return -1;
+    }
+    return ind;
+}
+
+int job_output_fd(job_t *job)
+{
+    // where the last stage of the pipeline writes
+    if (job->cache != NULL && job->cache->write_fd >= 0)
+    {
+        return job->cache->write_fd;
+    }
+    return (job->capture_fd >= 0) ? job->capture_fd : STDOUT_FILENO;
+}
+
+int replay_cached_result(job_t *job)
+{
+    // 1 when the job's output was replayed from the cache, 0 when it has to run (capturing its stdout if it can be cached)
+    process_t *last = job->first_process;
+    while (last->next != NULL)
+    {
+        last = last->next;
+    }
+    // only foreground output that ends up on the shell's stdout is worth keeping, and without a signalfd nobody drains the pipe
+    if (job->background || redirects_fd(last, STDOUT_FILENO) || sigchld_fd < 0)
+    {
+        job->cache = NULL;
+        return 0;
+    }
+    cache_request_t *cache = job->cache;
+    for (process_t *process = job->first_process; process != NULL; process = process->next)
+    {
+        // files read through < and <| are watched without being asked for
+        if (process->splice_input_filename != NULL)
+        {
+            cache->watch_paths[cache->watch_count++] = process->splice_input_filename;
+        }
+        for (redirect_t *redirect = process->redirects; redirect != NULL; redirect = redirect->next)
+        {
+            if (redirect->type == REDIRECT_READ)
+            {
+                cache->watch_paths[cache->watch_count++] = redirect->filename;
+            }
+        }
+    }
+    build_cache_key(job);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    result_cache_entry_t *entry = result_cache.head;
+    while (entry != NULL)
+    {
+        if (entry->hash == cache->hash && entry->key_length == cache->key_length && memcmp(entry->key, cache->key, cache->key_length) == 0)
+        {
+            break;
+        }
+        entry = entry->next;
+    }
+    if (entry != NULL && elapsed_seconds(&now, &entry->expires) > 0 && cache_watches_unchanged(entry->watch_paths, entry->watch_mtimes, entry->watch_count))
+    {
+        // move to the front of the LRU list
+        unlink_cache_entry(entry);
+        push_cache_entry(entry);
+        entry->hits++;
+        fflush(stdout);
+        for (size_t written = 0; written < entry->output_length;)
+        {
+            ssize_t count = write(STDOUT_FILENO, entry->output + written, entry->output_length - written);
+            if (count < 0 && errno != EINTR)
+            {
+                break;
+            }
+            written += (count > 0) ? count : 0;
+        }
+        last_exit_status = EXIT_SUCCESS;
+        return 1;
+    }
+    if (entry != NULL)
+    {
+        // expired or one of its files changed, the run below replaces it
+        unlink_cache_entry(entry);
+        free_cache_entry(entry);
+    }
+    cache->watch_mtimes = (struct timespec *)arena_alloc(job->arena, (cache->watch_count + 1) * sizeof(struct timespec));
+    for (int i = 0; i < cache->watch_count; i++)
+    {
+        struct stat st;
+        // a missing file counts as mtime 0, so creating it invalidates the result too
+        cache->watch_mtimes[i] = (stat(cache->watch_paths[i], &st) == 0) ? st.st_mtim : (struct timespec){0, 0};
+    }
+    int pipe_fd[2];
+    if (pipe2(pipe_fd, O_CLOEXEC) < 0)
+    {
+        perror("-yash: cache");
+        release_cache_request(job);
+        return 0;
+    }
+    fcntl(pipe_fd[0], F_SETFL, O_NONBLOCK);
+    cache->read_fd = pipe_fd[0];
+    cache->write_fd = pipe_fd[1];
+    return 0;
+}
+
+void build_cache_key(job_t *job)
+{
+    // everything that decides what the pipeline prints: its words and redirects, the cwd, PATH and the $YASH_CACHE_ENV variables
+    cache_request_t *cache = job->cache;
+    FILE *key = open_memstream(&cache->key, &cache->key_length);
+    for (process_t *process = job->first_process; process != NULL; process = process->next)
+    {
+        for (int i = 0; process->argv[i] != NULL; i++)
+        {
+            fprintf(key, "%s%c", process->argv[i], '\0');
+        }
+        for (redirect_t *redirect = process->redirects; redirect != NULL; redirect = redirect->next)
+        {
+            fprintf(key, "%d %d %d %s%c", redirect->type, redirect->fd, redirect->source_fd, (redirect->filename != NULL) ? redirect->filename : "", '\0');
+            if (redirect->text != NULL)
+            {
+                fwrite(redirect->text, 1, redirect->text_length, key);
+            }
+        }
+        fprintf(key, "|%c", '\0');
+    }
+    for (int i = 0; i < cache->watch_count; i++)
+    {
+        fprintf(key, "-w%s%c", cache->watch_paths[i], '\0');
+    }
+    char cwd[FILENAME_MAX];
+    fprintf(key, "cwd=%s%c", (getcwd(cwd, sizeof(cwd)) != NULL) ? cwd : "", '\0');
+    char *path = getenv("PATH");
+    fprintf(key, "PATH=%s%c", (path != NULL) ? path : "", '\0');
+    char *names = getenv(RESULT_CACHE_ENV);
+    while (names != NULL && *names != '\0')
+    {
+        size_t length = strcspn(names, ":");
+        char name[FILENAME_MAX];
+        if (length > 0 && length < sizeof(name))
+        {
+            memcpy(name, names, length);
+            name[length] = '\0';
+            char *value = getenv(name);
+            fprintf(key, "%s=%s%c", name, (value != NULL) ? value : "", '\0');
+        }
+        names += length + (names[length] == ':');
+    }
+    fclose(key);
+    cache->hash = hash_bytes(cache->key, cache->key_length);
+}
+
+int cache_watches_unchanged(char **paths, struct timespec *mtimes, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        struct stat st;
+        struct timespec mtime = (stat(paths[i], &st) == 0) ? st.st_mtim : (struct timespec){0, 0};
+        if (mtime.tv_sec != mtimes[i].tv_sec || mtime.tv_nsec != mtimes[i].tv_nsec)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void read_cached_output(job_t *job)
+{
+    // pass what the last stage wrote through to the shell's stdout, keeping a copy
+    cache_request_t *cache = job->cache;
+    char chunk[RESULT_CACHE_READ_CHUNK];
+    while (cache->read_fd >= 0)
+    {
+        ssize_t count = read(cache->read_fd, chunk, sizeof(chunk));
+        if (count < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            return;
+        }
+        if (count <= 0)
+        {
+            remove_event_source(cache->read_fd);
+            close(cache->read_fd);
+            cache->read_fd = -1;
+            return;
+        }
+        for (ssize_t written = 0; written < count;)
+        {
+            ssize_t result = write(STDOUT_FILENO, chunk + written, count - written);
+            if (result < 0 && errno != EINTR)
+            {
+                break;
+            }
+            written += (result > 0) ? result : 0;
+        }
+        if (cache->overflow)
+        {
+            continue;
+        }
+        if (cache->output_length + count > RESULT_CACHE_MAX_BYTES)
+        {
+            // could never be stored, stop copying
+            cache->overflow = 1;
+            continue;
+        }
+        if (cache->output_length + count > cache->output_capacity)
+        {
+            cache->output_capacity = (cache->output_capacity == 0) ? RESULT_CACHE_READ_CHUNK : cache->output_capacity;
+            while (cache->output_length + count > cache->output_capacity)
+            {
+                cache->output_capacity *= 2;
+            }
+            cache->output = (char *)realloc(cache->output, cache->output_capacity);
+        }
+        memcpy(cache->output + cache->output_length, chunk, count);
+        cache->output_length += count;
+    }
+}
+
+void finish_cached_result(job_t *job)
+{
+    // the job is done, pick up what is left in the pipe and keep the result if the run was clean
+    read_cached_output(job);
+    cache_request_t *cache = job->cache;
+    // a still open pipe means some background descendant holds it, so the output may not be complete
+    if (cache->read_fd < 0 && job->exit_code == 0 && !cache->overflow)
+    {
+        store_cached_result(job);
+    }
+    release_cache_request(job);
+}
+
+void store_cached_result(job_t *job)
+{
+    cache_request_t *cache = job->cache;
+    // evict the least recently used results until the new one fits
+    while (result_cache.tail != NULL && result_cache.bytes + cache->output_length > RESULT_CACHE_MAX_BYTES)
+    {
+        result_cache_entry_t *victim = result_cache.tail;
+        unlink_cache_entry(victim);
+        free_cache_entry(victim);
+    }
+    result_cache_entry_t *entry = (result_cache_entry_t *)malloc(sizeof(result_cache_entry_t));
+    memset(entry, 0, sizeof(result_cache_entry_t));
+    // the key and the output move over, the watched paths have to outlive the job's arena
+    entry->key = cache->key;
+    entry->key_length = cache->key_length;
+    entry->hash = cache->hash;
+    entry->output = cache->output;
+    entry->output_length = cache->output_length;
+    cache->key = NULL;
+    cache->output = NULL;
+    entry->command = strdup(job->command);
+    entry->watch_count = cache->watch_count;
+    entry->watch_paths = (char **)malloc((cache->watch_count + 1) * sizeof(char *));
+    entry->watch_mtimes = (struct timespec *)malloc((cache->watch_count + 1) * sizeof(struct timespec));
+    for (int i = 0; i < cache->watch_count; i++)
+    {
+        entry->watch_paths[i] = strdup(cache->watch_paths[i]);
+        entry->watch_mtimes[i] = cache->watch_mtimes[i];
+    }
+    // the ttl counts from when the run started
+    entry->expires = job->start_time;
+    entry->expires.tv_sec += (time_t)cache->ttl;
+    entry->expires.tv_nsec += (long)((cache->ttl - (time_t)cache->ttl) * 1e9);
+    if (entry->expires.tv_nsec >= 1000000000)
+    {
+        entry->expires.tv_sec++;
+        entry->expires.tv_nsec -= 1000000000;
+    }
+    push_cache_entry(entry);
+}
+
+void push_cache_entry(result_cache_entry_t *entry)
+{
+    // link in as the most recently used entry
+    entry->prev = NULL;
+    entry->next = result_cache.head;
+    if (entry->next != NULL)
+    {
+        entry->next->prev = entry;
+    }
+    result_cache.head = entry;
+    if (result_cache.tail == NULL)
+    {
+        result_cache.tail = entry;
+    }
+    result_cache.bytes += entry->output_length;
+    result_cache.count++;
+}
+
+void unlink_cache_entry(result_cache_entry_t *entry)
+{
+    if (entry->prev != NULL)
+    {
+        entry->prev->next = entry->next;
+    }
+    else
+    {
+        result_cache.head = entry->next;
+    }
+    if (entry->next != NULL)
+    {
+        entry->next->prev = entry->prev;
+    }
+    else
+    {
+        result_cache.tail = entry->prev;
+    }
+    entry->prev = NULL;
+    entry->next = NULL;
+    result_cache.bytes -= entry->output_length;
+    result_cache.count--;
+}
+
+void free_cache_entry(result_cache_entry_t *entry)
+{
+    for (int i = 0; i < entry->watch_count; i++)
+    {
+        free(entry->watch_paths[i]);
+    }
+    free(entry->watch_paths);
+    free(entry->watch_mtimes);
+    free(entry->key);
+    free(entry->command);
+    free(entry->output);
+    free(entry);
+}
+
+void release_cache_request(job_t *job)
+{
+    // everything of the request outside the job's arena
+    cache_request_t *cache = job->cache;
+    if (cache->read_fd >= 0)
+    {
+        close(cache->read_fd);
+    }
+    if (cache->write_fd >= 0)
+    {
+        close(cache->write_fd);
+    }
+    free(cache->key);
+    free(cache->output);
+    job->cache = NULL;
+}
+
+void free_result_cache()
+{
+    while (result_cache.head != NULL)
+    {
+        result_cache_entry_t *entry = result_cache.head;
+        unlink_cache_entry(entry);
+        free_cache_entry(entry);
+    }
+}
+
+// ==== COPROCESSES ==== //
+
+int start_coproc_pool(char *name, int worker_count, char *argv[])
+{
+    // one background job whose stages are the workers, so jobs, fg and the done notifications all just work
+    // every worker gets its own socketpair as stdin and stdout, the startup cost is paid once per worker instead of once per request
+    char *command = NULL;
+    size_t command_length = 0;
+    FILE *stream = open_memstream(&command, &command_length);
+    fprintf(stream, "%s %s:", COPROC, name);
+    int argc = 0;
+    for (; argv[argc] != NULL; argc++)
+    {
+        fprintf(stream, " %s", argv[argc]);
+    }
+    fclose(stream);
+    job_t *job = create_job(command, command_length);
+    free(command);
+    coproc_pool_t *pool = (coproc_pool_t *)arena_alloc(job->arena, sizeof(coproc_pool_t));
+    memset(pool, 0, sizeof(coproc_pool_t));
+    pool->name = arena_strdup(job->arena, name);
+    pool->job = job;
+    pool->workers = (coproc_worker_t *)arena_alloc(job->arena, worker_count * sizeof(coproc_worker_t));
+    memset(pool->workers, 0, worker_count * sizeof(coproc_worker_t));
+    job->coproc = pool;
+    job->background = 1;
+    job->capture_fd = -1;
+    job->cgroup_fd = -1;
+    job->cgroup_procs_fd = -1;
+    job->job_number = find_most_recent_job_num() + 1;
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &job->start_time);
+    session_jobs_run++;
+    open_job_cgroup(job);
+
+    pid_t pgid = 0;
+    process_t **next_process = &job->first_process;
+    for (int i = 0; i < worker_count; i++)
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+        {
+            perror("-yash: coproc");
+            break;
+        }
+        process_t *process = create_process(job, argc);
+        for (int j = 0; j < argc; j++)
+        {
+            process->argv[j] = arena_strdup(job->arena, argv[j]);
+        }
+        pid_t pid = spawn_process(job, process, pgid, fds[1], fds[1]);
+        close(fds[1]);
+        if (pid < 0)
+        {
+            perror("-yash: coproc");
+            close(fds[0]);
+            break;
+        }
+        pgid = (pgid == 0) ? pid : pgid;
+        *next_process = process;
+        next_process = &process->next;
+        // answers are read by the event loop, it never blocks on a worker
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        coproc_worker_t *worker = &pool->workers[pool->worker_count++];
+        worker->process = process;
+        worker->fd = fds[0];
+        add_event_source(worker->fd, EVENT_COPROC, worker->fd);
+    }
+    if (pool->worker_count == 0)
+    {
+        free_job(job);
+        return EXIT_FAILURE;
+    }
+    pool->next = coproc_pools;
+    coproc_pools = pool;
+    job->pgid = pgid;
+    job->status = RUNNING;
+    add_job(job);
+    return EXIT_SUCCESS;
+}
+
+coproc_pool_t *find_coproc_pool(const char *name)
+{
+    for (coproc_pool_t *pool = coproc_pools; pool != NULL; pool = pool->next)
+    {
+        if (strcmp(pool->name, name) == 0)
+        {
+            return pool;
+        }
+    }
+    return NULL;
+}
+
+coproc_worker_t *find_coproc_worker(int fd)
+{
+    for (coproc_pool_t *pool = coproc_pools; pool != NULL; pool = pool->next)
+    {
+        for (int i = 0; i < pool->worker_count; i++)
+        {
+            if (pool->workers[i].fd == fd)
+            {
+                return &pool->workers[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+coproc_worker_t *find_idle_worker(coproc_pool_t *pool)
+{
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        if (pool->workers[i].fd >= 0 && !pool->workers[i].busy)
+        {
+            return &pool->workers[i];
+        }
+    }
+    return NULL;
+}
+
+int coproc_workers_alive(coproc_pool_t *pool)
+{
+    int alive = 0;
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        alive += (pool->workers[i].fd >= 0);
+    }
+    return alive;
+}
+
+void read_coproc_output(int fd)
+{
+    // everything a worker writes is kept until print_coproc_responses, a request is answered by the first full line
+    coproc_worker_t *worker = find_coproc_worker(fd);
+    if (worker != NULL)
+    {
+        read_coproc_worker(worker);
+    }
+}
+
+void read_coproc_worker(coproc_worker_t *worker)
+{
+    while (worker->fd >= 0)
+    {
+        if (worker->response_capacity - worker->response_length < COPROC_READ_CHUNK)
+        {
+            worker->response_capacity = (worker->response_capacity == 0) ? COPROC_READ_CHUNK * 2 : worker->response_capacity * 2;
+            worker->response = (char *)realloc(worker->response, worker->response_capacity);
+        }
+        ssize_t count = read(worker->fd, worker->response + worker->response_length, worker->response_capacity - worker->response_length);
+        if (count > 0)
+        {
+            if (memchr(worker->response + worker->response_length, '\n', count) != NULL)
+            {
+                worker->answered = 1;
+                coproc_output_ready = 1;
+            }
+            worker->response_length += count;
+            continue;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            return;
+        }
+        // the worker exited or closed its stdout, whatever it left is printed as it is
+        close_coproc_worker(worker);
+        coproc_output_ready = 1;
+        return;
+    }
+}
+
+void close_coproc_worker(coproc_worker_t *worker)
 {
-    // job will already by malloc'ed into existance!
-    job_t *curr = job_list_head;
-    if (curr == NULL)
+    if (worker->fd >= 0)
     {
-        job_list_head = job;
-        return;
+        remove_event_source(worker->fd);
+        close(worker->fd);
+        worker->fd = -1;
     }
-    while (curr != NULL)
+}
+
+void print_coproc_responses()
+{
+    // full lines only, a partial answer waits for the rest unless the worker is gone
+    // outside of the event loop (between the lines of a script, or when a pool goes away) nothing read them yet
+    for (coproc_pool_t *pool = coproc_pools; pool != NULL; pool = pool->next)
     {
-        if (curr->next == NULL)
+        for (int i = 0; i < pool->worker_count; i++)
         {
-            curr->next = job;
-            return;
+            read_coproc_worker(&pool->workers[i]);
         }
-        curr = curr->next;
     }
-}
-
-void remove_done_jobs()
-{
-    job_t *curr = job_list_head;
-    job_t *prev = NULL;
-    if (curr == NULL)
+    if (!coproc_output_ready)
     {
         return;
     }
-    while (curr != NULL)
+    coproc_output_ready = 0;
+    for (coproc_pool_t *pool = coproc_pools; pool != NULL; pool = pool->next)
     {
-        job_t *temp = curr->next;
-        if (curr->status == DONE)
-        {
-            if (prev == NULL)
-            {
-                // we're removing the first node of the list
-                job_list_head = temp;
-                free_job(curr);
-                curr = temp;
-            }
-            else
-            {
-                // we're removing an element in the middle of the list
-                prev->next = temp;
-                free_job(curr);
-                curr = temp;
-            }
-        }
-        else
+        for (int i = 0; i < pool->worker_count; i++)
         {
-            // if an job is not DONE, we want to simply keep traversing
-            prev = curr;
-            curr = temp;
+            print_coproc_worker(&pool->workers[i]);
         }
     }
 }
 
-int remove_job(pid_t pgid, int fg_free)
+void print_coproc_worker(coproc_worker_t *worker)
 {
-    // because of fg and bg (moving fg to a bg process), we may not want to completely free a job!
-    // fg_free indicates that we just want to detach a job from the job LL to reinsert as a "bg" job
-    job_t *curr = job_list_head;
-    job_t *prev = NULL;
-    if (curr == NULL)
+    size_t length = worker->response_length;
+    while (worker->fd >= 0 && length > 0 && worker->response[length - 1] != '\n')
     {
-        return 0;
+        length--;
     }
-    while (curr != NULL)
+    if (length == 0)
     {
-        if (curr->pgid == pgid)
-        {
-            if (prev == NULL)
-            {
-                // remove head of job list / only one item in the LL
-                job_list_head = curr->next;
-                if (fg_free)
-                {
-                    free_job(curr);
-                }
-                return 1;
-            }
-            prev->next = curr->next;
-            if (fg_free)
-            {
-                free_job(curr);
-            }
-            return 1;
-        }
-        prev = curr;
-        curr = curr->next;
+        return;
     }
-    return 0;
+    fwrite(worker->response, 1, length, stdout);
+    fflush(stdout);
+    memmove(worker->response, worker->response + length, worker->response_length - length);
+    worker->response_length -= length;
+    worker->busy = 0;
+    worker->answered = 0;
 }
 
-job_t *find_job(pid_t pgid)
+void release_coproc_pool(job_t *job)
 {
-    job_t *curr = job_list_head;
-    if (curr == NULL)
+    // the workers are gone, but their last answers may still be unread
+    print_coproc_responses();
+    coproc_pool_t **link = &coproc_pools;
+    while (*link != NULL && *link != job->coproc)
     {
-        return NULL;
+        link = &(*link)->next;
     }
-    while (curr != NULL)
+    if (*link != NULL)
     {
-        if (curr->pgid == pgid)
-        {
-            return curr;
-        }
-        curr = curr->next;
+        *link = job->coproc->next;
     }
-    // printf("Job with pgid: [%d] not found!\n", pgid);
-    return NULL;
+    for (int i = 0; i < job->coproc->worker_count; i++)
+    {
+        close_coproc_worker(&job->coproc->workers[i]);
+        free(job->coproc->workers[i].response);
+    }
+    job->coproc = NULL;
 }
 
-void print_job_table(int print_running_jobs, int print_stopped_jobs, int print_done_jobs)
+// ==== PARALLEL QUEUE ==== //
+
+char *build_parallel_command(char *words[], int word_count, const char *arg)
 {
-    int most_recent_job_num = find_most_recent_job_num();
-    if (most_recent_job_num == 0)
+    // the template words joined back into a command line, with every {} replaced by arg (or arg appended if there is none)
+    // the words were unquoted by the lexer, so they are quoted again wherever the line gets lexed differently otherwise
+    size_t arg_len = strlen(arg);
+    size_t placeholder_len = strlen(PARALLEL_PLACEHOLDER);
+    int substituted = 0;
+    // a quoted character takes at most 4 bytes ('\''), plus the quotes and a separator per word
+    size_t size = 4 * arg_len + 4;
+    for (int i = 0; i < word_count; i++)
     {
-        // there are currently no background jobs in the job table
-        return;
+        size_t word_len = strlen(words[i]);
+        for (char *found = strstr(words[i], PARALLEL_PLACEHOLDER); found != NULL; found = strstr(found + placeholder_len, PARALLEL_PLACEHOLDER))
+        {
+            word_len += arg_len;
+            substituted = 1;
+        }
+        size += 4 * word_len + 3;
     }
-    // there are background jobs listed
-    job_t *curr = job_list_head;
-    int job_status;
-    int is_most_recent_job;
-    while (curr != NULL)
+    char *command = (char *)malloc(size);
+    char *write = command;
+    for (int i = 0; i <= word_count; i++)
     {
-        job_status = curr->status;
-        is_most_recent_job = (most_recent_job_num == curr->job_number) ? 1 : 0;
-        if (job_status == RUNNING && print_running_jobs == 1 && curr->background)
+        if (i == word_count && substituted)
         {
-            print_job(curr, is_most_recent_job, 0, 0);
+            break;
         }
-        else if (job_status == STOPPED && print_stopped_jobs == 1 && curr->background)
+        // the extra round appends arg as its own word
+        const char *word = (i < word_count) ? words[i] : arg;
+        if (i > 0)
         {
-            print_job(curr, is_most_recent_job, 0, 0);
+            *write++ = ' ';
         }
-        else if (job_status == DONE && print_done_jobs == 1 && curr->background)
+        int has_placeholder = (i < word_count && strstr(word, PARALLEL_PLACEHOLDER) != NULL);
+        int quote = (*word == '\0' || strpbrk(word, PARALLEL_QUOTED_CHARS) != NULL || (has_placeholder && (*arg == '\0' || strpbrk(arg, PARALLEL_QUOTED_CHARS) != NULL)));
+        if (quote)
+        {
+            *write++ = '\'';
+        }
+        while (*word != '\0')
+        {
+            const char *piece = word;
+            size_t piece_len = 1;
+            if (i < word_count && strncmp(word, PARALLEL_PLACEHOLDER, placeholder_len) == 0)
+            {
+                piece = arg;
+                piece_len = arg_len;
+                word += placeholder_len;
+            }
+            else
+            {
+                word++;
+            }
+            for (size_t j = 0; j < piece_len; j++)
+            {
+                if (piece[j] == '\'')
+                {
+                    // close the quote, add an escaped quote, reopen it
+                    memcpy(write, "'\\''", 4);
+                    write += 4;
+                }
+                else
+                {
+                    *write++ = piece[j];
+                }
+            }
+        }
+        if (quote)
         {
-            print_job(curr, is_most_recent_job, 0, 0);
+            *write++ = '\'';
         }
-        curr = curr->next;
     }
+    *write = '\0';
+    return command;
 }
 
-// ==== CUSTOM COMMAND FUNCTIONS ==== //
-int execute_custom_commands(char *command)
+void parallel_enqueue(char *command)
 {
-    if (strcmp(command, FOREGROUND) == 0)
+    if (parallel_queue.count == parallel_queue.capacity)
     {
-        execute_fg();
-        return 1;
+        parallel_queue.capacity = (parallel_queue.capacity == 0) ? PARALLEL_QUEUE_INITIAL_CAPACITY : parallel_queue.capacity * 2;
+        parallel_queue.commands = (char **)realloc(parallel_queue.commands, parallel_queue.capacity * sizeof(char *));
     }
-    else if (strcmp(command, BACKGROUND) == 0)
+    parallel_queue.commands[parallel_queue.count++] = command;
+}
+
+void start_parallel_jobs()
+{
+    // fill the free slots, called by the builtin and whenever a parallel job is reaped
+    while (parallel_queue.running < parallel_queue.max_running && parallel_queue.next < parallel_queue.count)
     {
-        execute_bg();
-        return 1;
+        char *command = parallel_queue.commands[parallel_queue.next];
+        parallel_queue.commands[parallel_queue.next++] = NULL;
+        job_t *job = parse_job_line(command, strlen(command));
+        free(command);
+        if (job != NULL)
+        {
+            job = expand_job(job);
+        }
+        if (job == NULL)
+        {
+            continue;
+        }
+        job->background = 1;
+        job->parallel = 1;
+        update_job_command_str(job, 1);
+        parallel_queue.running++;
+        execute_job(job);
     }
-    else if (strcmp(command, JOBS) == 0)
+    if (parallel_queue.next == parallel_queue.count)
     {
-        execute_jobs();
-        return 1;
+        // everything was started, reuse the array from the front
+        parallel_queue.next = 0;
+        parallel_queue.count = 0;
     }
-    return 0;
 }
 
-void execute_bg()
+void finish_parallel_jobs()
 {
-    // job statuses may have finished executing in the time of commandline processing to executing this command
-    update_job_table_statuses();
-    job_t *bg_job = find_next_job_to_bg();
-    if (bg_job == NULL)
+    // a script has no later prompt to start queued commands at, so block until the queue is empty before exiting
+    // (the last running jobs are left to finish in the background like any other)
+    while (parallel_queue.next < parallel_queue.count)
     {
-        // there are no stopped background jobs, so just end execution
-        return;
+        if (wait_for_child_events() < 0)
+        {
+            break;
+        }
     }
-    // update command associated with job to match BASH format when bringing a job into the foreground
-    update_job_command_str(bg_job, 1);
-    int most_recent_job_num = find_most_recent_job_num();
-    int is_most_recent_job = (most_recent_job_num == bg_job->job_number) ? 1 : 0;
-    bg_job->status = RUNNING;
-    print_job(bg_job, is_most_recent_job, 1, 0);
-    // santity check
-    bg_job->background = 1;
-    // send SIGCONT to bg_job pg, and wait for it in the background
-    continue_background_job(bg_job, 0);
 }
 
-job_t *find_next_job_to_bg()
+void free_parallel_queue()
 {
-    // exclude done jobs, but also be sure to take into account if the job already notified the terminal if it was completed
-    job_t *curr = job_list_head;
-    job_t *job_to_continue = NULL;
-    if (curr == NULL)
-    {
-        return NULL;
-    }
-    while (curr != NULL)
+    for (int i = parallel_queue.next; i < parallel_queue.count; i++)
     {
-        if (curr->background && curr->status == STOPPED)
-        {
-            job_to_continue = curr;
-        }
-        curr = curr->next;
+        free(parallel_queue.commands[i]);
     }
-    return job_to_continue;
+    free(parallel_queue.commands);
+    memset(&parallel_queue, 0, sizeof(parallel_queue_t));
 }
 
-void execute_fg()
+// ==== TRACING ==== //
+#ifdef YASH_TRACE
+
+void init_trace()
 {
-    // job statuses may have finished executing in the time of commandline processing to executing this command
-    update_job_table_statuses();
-    job_t *fg_job = find_next_job_to_fg();
-    if (fg_job == NULL)
+    char *directory = getenv(TRACE_ENV);
+    if (directory == NULL || *directory == '\0')
     {
-        // there are no running or stopped background jobs, so just end execution
         return;
     }
-    // don't need to update the job number: we can't enter any new commands (and thus no new jobs) since this job will be in the foreground
-    // update command associated with job to match BASH format when bringing a job into the foreground
-    update_job_command_str(fg_job, 0);
-    int most_recent_job_num = find_most_recent_job_num();
-    int is_most_recent_job = (most_recent_job_num == fg_job->job_number) ? 1 : 0;
-    fg_job->status = RUNNING;
-    print_job(fg_job, is_most_recent_job, 1, 1);
-    // make sure the job in the job list is no longer a background job
-    // do this after finding the most recent job to account for the fact that it might be latest stopped job
-    fg_job->background = 0;
-    // send SIGCONT to fg_job pg, and wait for it in the foreground
-    continue_background_job(fg_job, 1);
+    // one file per shell process, so substitutions and nested shells don't interleave with us
+    char path[FILENAME_MAX];
+    snprintf(path, sizeof(path), "%s/yash-trace-%d.json", directory, shell_pid);
+    trace_file = fopen(path, "we");
+    if (trace_file == NULL)
+    {
+        printf("-yash: %s: %s: %s\n", TRACE_ENV, path, strerror(errno));
+        return;
+    }
+    fputs("{\"traceEvents\": [\n", trace_file);
 }
 
-job_t *find_next_job_to_fg()
+void trace_event(const char *name, char phase, pid_t pid, int value)
 {
-    // exclude done jobs, but also be sure to take into account if the job already notified the terminal if it was completed
-    if (job_list_head == NULL)
+    // recording is a clock read and a store, formatting waits until the buffer is full or the shell exits
+    if (trace_file == NULL)
     {
-        return NULL;
+        return;
     }
-    job_t *curr = job_list_head;
-    job_t *job_to_continue = NULL;
-    while (curr != NULL)
+    if (trace_buffered == TRACE_BUFFER_EVENTS)
     {
-        if (curr->status != DONE)
-        {
-            job_to_continue = curr;
-        }
-        curr = curr->next;
+        flush_trace();
     }
-    return job_to_continue;
+    trace_event_t *event = &trace_buffer[trace_buffered++];
+    event->name = name;
+    event->phase = phase;
+    event->pid = pid;
+    event->value = value;
+    // CLOCK_MONOTONIC like every other timing in the shell, so traces of several shells line up
+    clock_gettime(CLOCK_MONOTONIC, &event->time);
 }
 
-void execute_jobs()
+void flush_trace()
 {
-    // job statuses may have finished executing in the time of commandline processing to executing this command
-    update_job_table_statuses();
-    // print DONE jobs
-    print_job_table(0, 0, 1);
-    // we have to do this due to the manner in which the execution of the shell while loop works
-    remove_done_jobs();
-    print_job_table(1, 1, 0);
+    // a flush in the middle of a session would look like the shell being slow, so it gets its own span
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    write_trace_events();
+    trace_event("flush_trace", 'B', -1, 0);
+    trace_buffer[0].time = start;
+    trace_event("flush_trace", 'E', -1, 0);
 }
 
-// ==== DEBUGGING FUNCTIONS ==== //
-
-void print_job(job_t *job, int is_most_recent_job, int custom_command, int command_is_fg)
+void write_trace_events()
 {
-    char status[20] = "Unknown";
-    memset(status, '\0', sizeof(char) * 20);
-    switch (job->status)
+    for (int i = 0; i < trace_buffered; i++)
     {
-    case (RUNNING):
-        strcpy(status, "Running");
-        break;
-    case (STOPPED):
-        strcpy(status, "Stopped");
-        break;
-    case (DONE):
-        strcpy(status, "Done");
-        break;
-    default:
-        break;
+        trace_event_t *event = &trace_buffer[i];
+        fprintf(trace_file, "%s{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d", (trace_events_written++ > 0) ? ",\n" : "",
+                event->name, event->phase, event->time.tv_sec * 1e6 + event->time.tv_nsec / 1e3, shell_pid, shell_pid);
+        if (event->phase == 'i')
+        {
+            fprintf(trace_file, ", \"s\": \"p\", \"args\": {\"pid\": %d, \"status\": %d}}", event->pid, event->value);
+        }
+        else if (event->pid >= 0)
+        {
+            fprintf(trace_file, ", \"args\": {\"pid\": %d}}", event->pid);
+        }
+        else
+        {
+            fputs("}", trace_file);
+        }
     }
+    trace_buffered = 0;
+}
 
-    if (custom_command && command_is_fg)
+void finish_trace()
+{
+    if (trace_file == NULL)
     {
-        // means the command "fg" was run, so print the command directly to the terminal
-        // no discrimination whether
-        printf("%s\n", job->command);
+        return;
     }
-    else if (is_most_recent_job && custom_command && !command_is_fg)
+    write_trace_events();
+    fputs("\n]}\n", trace_file);
+    fclose(trace_file);
+    trace_file = NULL;
+}
+
+#endif
+
+// ==== FUZZING ==== //
+
+#ifdef YASH_FUZZ
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    // one command line through the lexer, process_input and expand_job (make fuzz), nothing is run
+    static int initialized;
+    if (!initialized)
     {
-        // printing job in the "jobs" format for the most recent job created
-        printf("[%d]+\t%s\n", job->job_number, job->command);
+        shell_pid = getpid();
+        init_job_table();
+        initialized = 1;
     }
-    else if (!is_most_recent_job && custom_command && !command_is_fg)
+    char *command = (char *)malloc(size + 1);
+    memcpy(command, data, size);
+    command[size] = '\0';
+    job_t *job = parse_job_line(command, size);
+    free(command);
+    while (job != NULL)
     {
-        // printing job in the "jobs" format for previous jobs
-        printf("[%d]-\t%s\n", job->job_number, job->command);
+        // every part is expanded like execute_job_list would right before running it
+        job_t *next = job->list_next;
+        job->list_next = NULL;
+        job = expand_job(job);
+        if (job != NULL)
+        {
+            free_job(job);
+        }
+        job = next;
     }
-    else if (is_most_recent_job && !custom_command)
+    // the parse error messages are expected, they are only flushed so stdout doesn't grow without bound
+    fflush(stdout);
+    return 0;
+}
+
+#ifdef YASH_FUZZ_DRIVER
+int main(int argc, char *argv[])
+{
+    // make fuzz_driver: the entry point without libFuzzer, so a gcc sanitizer build can replay crashes and corpora
+    // every argument is an input file or a corpus directory of them, with none the one input is stdin
+    if (argc < 2)
     {
-        // printing job in the "job table" format for the most recent job created
-        printf("[%d]+\t%s\t\t\t%s\n", job->job_number, status, job->command);
+        return (fuzz_input_fd(STDIN_FILENO) < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
     }
-    else if (!is_most_recent_job && !custom_command)
+    int status = EXIT_SUCCESS;
+    int input_count = 0;
+    for (int i = 1; i < argc; i++)
     {
-        // printing job in the "job table" format for previous jobs
-        printf("[%d]-\t%s\t\t\t%s\n", job->job_number, status, job->command);
+        int count = fuzz_input_path(argv[i]);
+        if (count < 0)
+        {
+            status = EXIT_FAILURE;
+            continue;
+        }
+        input_count += count;
     }
+    fprintf(stderr, "fuzz driver: %d inputs\n", input_count);
+    return status;
 }
 
-int find_most_recent_job_num()
+int fuzz_input_path(const char *path)
 {
-    // In this case, it okay to include jobs that are DONE. This function is only called in functions where done jobs are printed out before they are erased
-    // so any cases where added bg jobs may appear to be +1 of the latest bg job will never happen since done jobs will be printed first!
-    job_t *curr = job_list_head;
-    int recent_job_num = 0;
-    if (curr == NULL)
+    // returns the number of inputs run, -1 if path could not be read
+    DIR *dir = opendir(path);
+    if (dir == NULL)
     {
-        return 0;
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            write_error_message(path, errno);
+            return -1;
+        }
+        int result = fuzz_input_fd(fd);
+        close(fd);
+        return (result < 0) ? -1 : 1;
     }
-    int include_job;
-    while (curr != NULL)
+    // libFuzzer corpora are flat, subdirectories and dot files are skipped
+    int count = 0;
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)) != NULL)
     {
-        // see if we include this job in assessing the most recent job number
-        recent_job_num = (curr->job_number > recent_job_num && curr->background) ? curr->job_number : recent_job_num;
-        curr = curr->next;
+        if (dirent->d_name[0] == '.')
+        {
+            continue;
+        }
+        int fd = openat(dirfd(dir), dirent->d_name, O_RDONLY | O_CLOEXEC);
+        struct stat input_stat;
+        if (fd < 0 || fstat(fd, &input_stat) < 0 || !S_ISREG(input_stat.st_mode))
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            continue;
+        }
+        if (fuzz_input_fd(fd) == 0)
+        {
+            count++;
+        }
+        close(fd);
     }
-    return recent_job_num;
+    closedir(dir);
+    return count;
 }
 
-void free_job_table()
+int fuzz_input_fd(int fd)
 {
-    job_t *curr = job_list_head;
-    job_t *next;
-    if (curr == NULL)
+    // the whole input is one call, like libFuzzer hands it over
+    size_t capacity = FUZZ_READ_CHUNK;
+    size_t size = 0;
+    uint8_t *data = (uint8_t *)malloc(capacity);
+    ssize_t bytes;
+    while ((bytes = read(fd, data + size, capacity - size)) != 0)
     {
-        return;
-    }
-    while (curr != NULL)
-    {
-        next = curr->next;
-        free_job(curr);
-        curr = next;
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            write_error_message("fuzz driver", errno);
+            free(data);
+            return -1;
+        }
+        size += bytes;
+        if (size == capacity)
+        {
+            capacity *= 2;
+            data = (uint8_t *)realloc(data, capacity);
+        }
     }
+    LLVMFuzzerTestOneInput(data, size);
+    free(data);
+    return 0;
 }
+#endif
+#endif
 
-void free_job(job_t *job)
+// ==== STRESS TEST ==== //
+
+#ifdef YASH_STRESS
+int main(int argc, char *argv[])
 {
-    if (job->first_process)
+    // make stress: a script's background job churn straight through the job table, nothing is spawned
+    // each round has to leave the table empty, anything that slips out of it is left for LeakSanitizer at exit
+    int rounds = (argc > 1) ? atoi(argv[1]) : STRESS_DEFAULT_ROUNDS;
+    shell_pid = getpid();
+    interactive = 0;
+    init_job_table();
+    pid_t next_pid = STRESS_FIRST_PID;
+    for (int round = 0; round < rounds; round++)
     {
-        free_process(job->first_process);
+        if (stress_job_table_round(round, &next_pid) < 0)
+        {
+            return EXIT_FAILURE;
+        }
     }
-    if (job->second_process)
+    free_job_table();
+    fprintf(stderr, "stress: %d rounds of %d jobs\n", rounds, STRESS_JOBS_PER_ROUND);
+    return EXIT_SUCCESS;
+}
+
+int stress_job_table_round(int round, pid_t *next_pid)
+{
+    // starts a batch of background pipelines, reaps every stage like update_job_table_statuses and
+    // frees them like the end of a command line, then checks that only their saved statuses are left
+    // returns -1 after printing what went wrong
+    pid_t first_pid = *next_pid;
+    for (int i = 0; i < STRESS_JOBS_PER_ROUND; i++)
     {
-        free_process(job->second_process);
+        char command[] = STRESS_COMMAND;
+        job_t *job = parse_job_line(command, strlen(command));
+        if (job == NULL || !job->background)
+        {
+            fprintf(stderr, "stress: round %d: %s did not parse as a background job\n", round, STRESS_COMMAND);
+            return -1;
+        }
+        job->job_number = find_most_recent_job_num() + 1;
+        job->cgroup_fd = -1;
+        job->cgroup_procs_fd = -1;
+        job->capture_fd = -1;
+        for (process_t *process = job->first_process; process != NULL; process = process->next)
+        {
+            process->pid = (*next_pid)++;
+        }
+        job->pgid = job->first_process->pid;
+        add_job(job);
     }
-    if (job->command)
+    // every stage exits with the round number, so a status saved by an earlier round cannot pass for this one
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    int exit_code = round % 128;
+    for (pid_t pid = first_pid; pid < *next_pid; pid++)
     {
-        free(job->command);
+        update_job_status(exit_code << 8, pid, &usage);
     }
-    // free job object itself
-    free(job);
-}
-void free_process(process_t *process)
-{
-    // free all memory used for filename storage
-    if (process->redirect_input_filename)
+    remove_done_jobs();
+
+    if (job_table.highest_job_num != 0 || job_table.done_jobs != NULL || job_table.pid_count != 0)
     {
-        free(process->redirect_input_filename);
+        fprintf(stderr, "stress: round %d: %d jobs and %d pids left in the table\n", round, job_table.highest_job_num, job_table.pid_count);
+        return -1;
     }
-    if (process->redirect_output_filename)
+    if (job_table.saved_status_count > SAVED_STATUS_MAX)
     {
-        free(process->redirect_output_filename);
+        fprintf(stderr, "stress: round %d: %d saved statuses\n", round, job_table.saved_status_count);
+        return -1;
     }
-    if (process->redirect_error_filename)
+    // wait takes a status once, by pid here (the job numbers start over every round)
+    char spec[32];
+    snprintf(spec, sizeof(spec), "%d", first_pid);
+    int slot = find_saved_status(spec);
+    if (slot < 0 || job_table.saved_statuses[slot].exit_code != exit_code)
     {
-        free(process->redirect_error_filename);
+        fprintf(stderr, "stress: round %d: no saved status %d for pid %s\n", round, exit_code, spec);
+        return -1;
     }
-    // free all memory used for argv arg storage
-    int i = 0;
-    while (process->argv[i] != NULL)
+    forget_saved_status(slot);
+    if (find_saved_status(spec) >= 0)
     {
-        free(process->argv[i]);
-        i++;
+        fprintf(stderr, "stress: round %d: pid %s still has a saved status after wait took it\n", round, spec);
+        return -1;
     }
-    // the process struct doesn't have any primitive types, so this is likely not necessary - still good to sanity check!
-    free(process);
+    return 0;
 }
+#endif
 
 // ==== DEBUGGING FUNCTIONS ==== //
 void print_parsed_command_debug(char *buffer[])
@@ -1101,22 +7917,20 @@ void print_job_debug(job_t *job)
     printf("job_number: %d\n", job->job_number);
     printf("background: %d\n", job->background);
     printf("status: %d\n", job->status);
-    if (job->first_process != NULL)
+    int process_num = 1;
+    for (process_t *process = job->first_process; process != NULL; process = process->next)
     {
-        printf("First Process:\n---\n");
-        print_process_debug(job->first_process);
-    }
-    if (job->second_process != NULL)
-    {
-        printf("Second Process:\n---\n");
-        print_process_debug(job->second_process);
+        printf("Process %d:\n---\n", process_num++);
+        print_process_debug(process);
     }
 }
 
 void print_process_debug(process_t *process)
 {
     print_parsed_command_debug(process->argv);
-    printf("input file: %s\n", process->redirect_input_filename);
-    printf("output file: %s\n", process->redirect_output_filename);
-    printf("error file: %s\n", process->redirect_error_filename);
+    printf("splice input file: %s\n", process->splice_input_filename);
+    for (redirect_t *redirect = process->redirects; redirect != NULL; redirect = redirect->next)
+    {
+        printf("redirect: type %d fd %d source fd %d file %s\n", redirect->type, redirect->fd, redirect->source_fd, redirect->filename);
+    }
 }